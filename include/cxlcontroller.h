@@ -7,13 +7,46 @@
 
 #include "cxlcounter.h"
 #include "cxlendpoint.h"
+#include "cxltopology.h"
+#include "samplebatch.h"
 #include <cstdint>
+#include <string>
 #include <string_view>
 #include <unordered_map>
 #include <vector>
 
 enum page_type { CACHELINE, PAGE, HUGEPAGE_2M, HUGEPAGE_1G };
 
+inline uint64_t page_type_size(enum page_type page_type_) {
+    switch (page_type_) {
+    case CACHELINE:
+        return 64;
+    case HUGEPAGE_2M:
+        return 2 * 1024 * 1024;
+    case HUGEPAGE_1G:
+        return 1024 * 1024 * 1024;
+    default:
+        return 4096;
+    }
+}
+
+/** the -m option, anything unknown is a page */
+inline enum page_type page_type_of(std::string_view mode) {
+    if (mode == "hugepage_2M") {
+        return HUGEPAGE_2M;
+    } else if (mode == "hugepage_1G") {
+        return HUGEPAGE_1G;
+    } else if (mode == "cacheline") {
+        return CACHELINE;
+    }
+    return PAGE;
+}
+
+namespace cxxopts {
+class Options;
+class ParseResult;
+} // namespace cxxopts
+
 class CXLController;
 class AllocationPolicy {
 public:
@@ -43,23 +76,67 @@ public:
     int capacity; // GB
     AllocationPolicy *policy;
     CXLCounter counter;
-    std::map<uint64_t, uint64_t> occupation;
+    Occupation occupation;
     std::map<uint64_t, uint64_t> va_pa_map;
+    std::unordered_map<uint64_t, int> placement; // unit, expander index or -1 for local
+    std::vector<uint64_t> dropped; // local units aged out or deleted since their placement was last pruned
     enum page_type page_type_; // percentage
     int num_switches = 0;
+    CXLTopology topology; // compiled by construct_topo
+    int window_epochs = 0; // keep occupation for the last N epochs, 0 for unbounded
+    size_t window_budget = 0; // max occupation entries per expander, 0 for unbounded
 
     CXLController(AllocationPolicy *p, int capacity, enum page_type page_type_, int epoch);
+    ~CXLController(); // the expanders, the policy stays with the caller
     void construct_topo(std::string_view newick_tree);
     void insert_end_point(CXLMemExpander *end_point);
     std::vector<std::string> tokenize(const std::string_view &s);
-    std::tuple<double, std::vector<uint64_t>> calculate_congestion() override;
+    std::tuple<double, uint64_t> calculate_congestion() override;
     void set_epoch(int epoch) override;
     std::tuple<int, int> get_all_access() override;
     double calculate_latency(LatencyPass elem) override; // traverse the tree to calculate the latency
     double calculate_bandwidth(BandwidthPass elem) override;
-    int insert(uint64_t timestamp, uint64_t phys_addr, uint64_t virt_addr, int index) override;
+    int insert(uint64_t timestamp, uint64_t phys_addr, uint64_t virt_addr, int index, int type) override;
+    /** insert a whole batch in order, each sample counted as batch.weight accesses, a store as batch.store_weight,
+     * return the number of samples the model took */
+    size_t insert_batch(const SampleBatch &batch);
+    /** drop the units wholly inside [addr, addr + length) here and below, and forget where they were placed */
     void delete_entry(uint64_t addr, uint64_t length) override;
+    void set_window(int epochs, size_t budget);
+    /** read, write bandwidth pairs of the upstream ports indexed by switch id, the root first */
+    void set_port_bandwidth(const std::vector<int> &bandwidth);
+    double calculate_queueing(LatencyPass lat, BandwidthPass bw);
+    /** age the local and expander occupation out of the window, return the number of entries dropped */
+    size_t age_out();
+    size_t age_out_local(uint64_t cutoff);
     std::string output() override;
+
+private:
+    static constexpr int unplaced = INT32_MIN;
+    std::vector<int> batch_target; // per sample placement of the batch in flight
+    int insert_placed(uint64_t timestamp, uint64_t phys_addr, uint64_t virt_addr, int index_, int type);
+    /** forget the placements of the units dropped here and in the expanders, in the number of them */
+    void prune_placement();
 };
 
+/** What -e, -l, -b, -o, -m, -i, --window, --budget and --port_bandwidth describe, so the simulator and the offline
+ * tools build the same controller */
+struct ControllerConfig {
+    std::vector<int> capacity; // GB, the local memory first then one per expander
+    std::vector<int> latency; // read, write pairs per expander
+    std::vector<int> bandwidth; // read, write pairs per expander
+    std::string topology;
+    enum page_type mode = PAGE;
+    int interval = 1000; // ms
+    int window = 0;
+    uint64_t budget = 0;
+    std::vector<int> port_bandwidth;
+    CXLController *build(AllocationPolicy *policy) const;
+    /** from the options add_model_options added plus -i, which every tool defines for itself */
+    static ControllerConfig from(const cxxopts::ParseResult &result);
+};
+
+/** the model options -m, -o, -e, -l, -b, -d, --window, --budget and --port_bandwidth, shared by every tool */
+void add_model_options(cxxopts::Options &options);
+
 #endif // CXLMEMSIM_CXLCONTROLLER_H
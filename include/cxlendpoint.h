@@ -6,49 +6,133 @@
 #define CXLMEMSIM_CXLENDPOINT_H
 #include "cxlcounter.h"
 #include "helper.h"
+#include "occupation.h"
+#include <algorithm>
 
+/** Fixed capacity LRU sized at construction: keys live in an open addressing table pointing into a node array, the
+ * recency list is linked by node index and the writeback value is stored inline, so nothing is allocated after the
+ * constructor. Eviction reuses the least recently used node in place. */
 class LRUCache {
-    std::list<uint64_t> lru_list;
-    std::unordered_map<uint64_t, std::list<uint64_t>::iterator> lru_map;
-    std::unordered_map<uint64_t, uint64_t> wb_map;
+    static constexpr uint32_t npos = UINT32_MAX;
+    struct Node {
+        uint64_t key;
+        uint64_t value;
+        uint32_t prev;
+        uint32_t next;
+    };
+    std::vector<Node> nodes;
+    std::vector<uint32_t> table; // node index, npos for empty
+    uint64_t mask = 0;
+    uint32_t head = npos; // most recently used
+    uint32_t tail = npos; // least recently used
+    size_t used = 0;
     size_t capacity;
 
+    uint64_t home(uint64_t key) const { return (key * 0x9E3779B97F4A7C15ULL >> 17) & mask; }
+    uint64_t find_slot(uint64_t key) const {
+        auto i = home(key);
+        while (table[i] != npos && nodes[table[i]].key != key) {
+            i = (i + 1) & mask;
+        }
+        return i;
+    }
+    void unlink(uint32_t n) {
+        auto &node = nodes[n];
+        if (node.prev != npos) {
+            nodes[node.prev].next = node.next;
+        } else {
+            head = node.next;
+        }
+        if (node.next != npos) {
+            nodes[node.next].prev = node.prev;
+        } else {
+            tail = node.prev;
+        }
+    }
+    void push_front(uint32_t n) {
+        nodes[n].prev = npos;
+        nodes[n].next = head;
+        if (head != npos) {
+            nodes[head].prev = n;
+        } else {
+            tail = n;
+        }
+        head = n;
+    }
+    /** backward shift deletion keeps probe chains intact without tombstones */
+    void erase_slot(uint64_t i) {
+        auto j = i;
+        while (true) {
+            j = (j + 1) & mask;
+            if (table[j] == npos) {
+                break;
+            }
+            auto k = home(nodes[table[j]].key);
+            if ((j > i && (k <= i || k > j)) || (j < i && k <= i && k > j)) {
+                table[i] = table[j];
+                i = j;
+            }
+        }
+        table[i] = npos;
+    }
+
 public:
-    LRUCache(size_t cap) : capacity(cap) {}
+    LRUCache(size_t cap) : capacity(cap) {
+        size_t size = 2;
+        while (size < cap * 2) {
+            size <<= 1;
+        }
+        nodes.resize(cap);
+        table.assign(size, npos);
+        mask = size - 1;
+    }
 
     void insert(uint64_t key, uint64_t value) {
-        // Check if the item is already in the cache
-        if (lru_map.find(key) != lru_map.end()) {
+        if (capacity == 0) {
+            return;
+        }
+        auto i = find_slot(key);
+        if (table[i] != npos) {
             // Move the element to the front of the list
-            lru_list.erase(lru_map[key]);
-            lru_list.push_front(key);
-            lru_map[key] = lru_list.begin();
-            wb_map[key] = value;
-        } else {
-            // If the cache is full, remove the least recently used item
-            if (lru_list.size() == capacity) {
-                uint64_t old_key = lru_list.back();
-                lru_list.pop_back();
-                lru_map.erase(old_key);
-                wb_map.erase(old_key);
+            auto n = table[i];
+            nodes[n].value = value;
+            if (n != head) {
+                unlink(n);
+                push_front(n);
             }
-            // Insert the new item
-            lru_list.push_front(key);
-            lru_map[key] = lru_list.begin();
-            wb_map[key] = value;
+            return;
+        }
+        uint32_t n;
+        if (used == capacity) {
+            // If the cache is full, recycle the least recently used node
+            n = tail;
+            unlink(n);
+            erase_slot(find_slot(nodes[n].key));
+            i = find_slot(key);
+        } else {
+            n = used++;
         }
+        nodes[n].key = key;
+        nodes[n].value = value;
+        table[i] = n;
+        push_front(n);
     }
 
     uint64_t get(uint64_t key) {
-        if (lru_map.find(key) == lru_map.end()) {
+        auto n = capacity == 0 ? npos : table[find_slot(key)];
+        if (n == npos) {
             throw std::runtime_error("Key not found");
         }
         // Move the accessed item to the front of the list
-        lru_list.erase(lru_map[key]);
-        lru_list.push_front(key);
-        lru_map[key] = lru_list.begin();
-        return wb_map[key];
+        if (n != head) {
+            unlink(n);
+            push_front(n);
+        }
+        return nodes[n].value;
     }
+
+    bool contains(uint64_t key) const { return capacity != 0 && table[find_slot(key)] != npos; }
+    size_t size() const { return used; }
 };
 
 class CXLEndPoint {
@@ -57,9 +141,17 @@ class CXLEndPoint {
     virtual void delete_entry(uint64_t addr, uint64_t length) = 0;
     virtual double calculate_latency(LatencyPass elem) = 0; // traverse the tree to calculate the latency
     virtual double calculate_bandwidth(BandwidthPass elem) = 0;
-    virtual int insert(uint64_t timestamp, uint64_t phys_addr, uint64_t virt_addr,
-                       int index) = 0; // 0 not this endpoint, 1 store, 2 load, 3 prefetch
+    virtual int insert(uint64_t timestamp, uint64_t phys_addr, uint64_t virt_addr, int index,
+                       int type) = 0; // 0 not this endpoint, 1 store, 2 load, 3 prefetch
     virtual std::tuple<int, int> get_all_access() = 0;
+
+public:
+    virtual ~CXLEndPoint() = default;
+    /** Address span ever inserted below this endpoint, lets delete_entry skip subtrees that cannot hold the range */
+    uint64_t min_addr = UINT64_MAX;
+    uint64_t max_addr = 0;
+    void extend_span(uint64_t addr);
+    bool overlaps(uint64_t addr, uint64_t length) const;
 };
 
 class CXLMemExpander : public CXLEndPoint {
@@ -67,8 +159,10 @@ public:
     EmuCXLBandwidth bandwidth;
     EmuCXLLatency latency;
     uint64_t capacity;
-    std::map<uint64_t, uint64_t> occupation; // timestamp, pa
+    Occupation occupation; // pa, ordered by last touch
     std::map<uint64_t, uint64_t> va_pa_map; // va, pa
+    size_t occupation_budget = 0; // max entries kept, 0 for unbounded
+    std::vector<uint64_t> dropped; // units aged out or deleted since the controller last forgot their placement
     CXLMemExpanderEvent counter{};
     CXLMemExpanderEvent last_counter{};
 
@@ -83,10 +177,12 @@ public:
     CXLMemExpander(int read_bw, int write_bw, int read_lat, int write_lat, int id, int capacity);
     std::tuple<int, int> get_all_access() override;
     void set_epoch(int epoch) override;
-    int insert(uint64_t timestamp, uint64_t phys_addr, uint64_t virt_addr, int index) override;
+    int insert(uint64_t timestamp, uint64_t phys_addr, uint64_t virt_addr, int index, int type) override;
     double calculate_latency(LatencyPass elem) override; // traverse the tree to calculate the latency
     double calculate_bandwidth(BandwidthPass elem) override;
     void delete_entry(uint64_t addr, uint64_t length) override;
+    /** drop entries last touched before cutoff or over budget together with their va mapping */
+    size_t age_out(uint64_t cutoff);
     std::string output() override;
 };
 class CXLSwitch : public CXLEndPoint {
@@ -97,18 +193,36 @@ public:
     int id = -1;
     int epoch = 0;
     uint64_t last_timestamp = 0;
-    // get the approximate congestion and target done time
-    std::unordered_map<uint64_t, uint64_t> timeseries_map;
+    /* streaming congestion model: an arrival closer than congestion_window to the previous one through this switch
+     * collides. Updated on every routed sample, re-touches included, so the epoch end only reads and resets the tally.
+     * Arrivals are compared in the order they reach the model, time ordered within a batch */
+    uint64_t congestion_window = 2000; // 20ns
+    uint64_t last_arrival = 0;
+    uint64_t epoch_conflicts = 0;
 
     double congestion_latency = 0.02;
+    // upstream port towards the host, same unit as the expander bandwidth, 0 for unlimited
+    double port_read_bandwidth = 0;
+    double port_write_bandwidth = 0;
     explicit CXLSwitch(int id);
+    ~CXLSwitch(); // the child switches, the expanders belong to the controller
     std::tuple<int, int> get_all_access() override;
     double calculate_latency(LatencyPass elem) override; // traverse the tree to calculate the latency
     double calculate_bandwidth(BandwidthPass elem) override;
-    int insert(uint64_t timestamp, uint64_t phys_addr, uint64_t virt_addr, int index) override;
+    int insert(uint64_t timestamp, uint64_t phys_addr, uint64_t virt_addr, int index, int type) override;
     void delete_entry(uint64_t addr, uint64_t length) override;
     std::string output() override;
-    virtual std::tuple<double, std::vector<uint64_t>> calculate_congestion();
+    /** account one arrival against the congestion window */
+    void record_arrival(uint64_t timestamp) {
+        auto gap = timestamp > last_arrival ? timestamp - last_arrival : last_arrival - timestamp;
+        if (last_arrival != 0 && gap < congestion_window) {
+            epoch_conflicts++;
+            counter.inc_conflict();
+        }
+        last_arrival = timestamp;
+    }
+    /** the added latency and the conflicts of this subtree since the last call */
+    virtual std::tuple<double, uint64_t> calculate_congestion();
     void set_epoch(int epoch) override;
 };
 
@@ -0,0 +1,30 @@
+#ifndef CXLMEMSIM_CXLKERNEL_H
+#define CXLMEMSIM_CXLKERNEL_H
+
+#include <cstddef>
+
+/** latency delay of every expander from its read and write counts of the epoch, written to out, return the sum.
+ * read_coef and write_coef fold the target's misses over all accesses */
+using LatencyKernel = double (*)(size_t n, const double *read, const double *write, const double *read_latency,
+                                 const double *write_latency, double read_coef, double write_coef, double dramlatency,
+                                 double *out);
+/** bandwidth delay summed over every expander whose read or write throughput is above its bandwidth, given as the
+ * reciprocal so the hot loop only multiplies. read_coef and write_coef fold the system wide traffic over all
+ * accesses */
+using BandwidthKernel = double (*)(size_t n, const double *read, const double *write, const double *latency,
+                                   const double *inv_read_bandwidth, const double *inv_write_bandwidth,
+                                   double read_coef, double write_coef, double epoch);
+
+/** Batched per expander delay terms over the packed topology arrays */
+struct DelayKernel {
+    const char *name;
+    LatencyKernel latency;
+    BandwidthKernel bandwidth;
+};
+
+extern const DelayKernel scalar_kernel;
+extern const DelayKernel avx512_kernel;
+/** the widest kernel the running CPU supports, picked once */
+const DelayKernel &delay_kernel();
+
+#endif // CXLMEMSIM_CXLKERNEL_H
@@ -0,0 +1,73 @@
+#ifndef CXLMEMSIM_CXLTOPOLOGY_H
+#define CXLMEMSIM_CXLTOPOLOGY_H
+
+#include "cxlendpoint.h"
+#include "cxlkernel.h"
+#include <cstdint>
+#include <string>
+#include <tuple>
+#include <vector>
+
+/** Flat structure of arrays view of the switch/expander tree, compiled once after construct_topo so the per epoch
+ * model passes are tight loops over contiguous memory instead of recursive virtual calls. Expanders are laid out in
+ * depth first order, so every switch covers the contiguous expander range [first, last). Switch 0 is the root. */
+class CXLTopology {
+public:
+    /* switches */
+    std::vector<CXLSwitch *> switch_node;
+    std::vector<int> switch_parent; // -1 for the root
+    std::vector<uint32_t> switch_first;
+    std::vector<uint32_t> switch_last;
+    std::vector<double> switch_load;
+    std::vector<double> switch_store;
+    /* upstream ports, every sample below a switch is charged to its port */
+    std::vector<double> port_read_bandwidth; // 0 for unlimited
+    std::vector<double> port_write_bandwidth;
+    std::vector<double> port_last_load;
+    std::vector<double> port_last_store;
+    std::vector<double> port_read; // accesses in the last epoch
+    std::vector<double> port_write;
+    std::vector<double> port_read_utilization;
+    std::vector<double> port_write_utilization;
+    std::vector<double> port_queue_delay; // ns
+    /* expanders */
+    std::vector<CXLMemExpander *> expander_node;
+    std::vector<int> expander_parent;
+    std::vector<double> read_latency;
+    std::vector<double> write_latency;
+    std::vector<double> inv_read_bandwidth;
+    std::vector<double> inv_write_bandwidth;
+    std::vector<double> load;
+    std::vector<double> store;
+    std::vector<double> last_load;
+    std::vector<double> last_store;
+    std::vector<double> last_read; // accesses in the last epoch
+    std::vector<double> last_write;
+    std::vector<double> last_latency;
+    std::vector<int> route; // expander id, leaf index or -1
+    double epoch = 0;
+    double weight = 1; // accesses one sample stands for, its period over the base period
+    const DelayKernel *kernel = &delay_kernel(); // the per expander latency and bandwidth terms
+
+    void compile(CXLSwitch *root, int epoch);
+    size_t num_switches() const { return switch_node.size(); }
+    size_t num_expanders() const { return expander_node.size(); }
+    /** route a sample straight to the leaf for expander id and account it on every ancestor in one pass up the
+     * parent chain, O(depth) regardless of fan-out */
+    int insert(uint64_t timestamp, uint64_t phys_addr, uint64_t virt_addr, int id, int type);
+    std::tuple<int, int> get_all_access();
+    double calculate_latency(const LatencyPass &elem);
+    double calculate_bandwidth(const BandwidthPass &elem);
+    /** O(switches): sums the tallies record_arrival kept on the insert path and starts a new epoch */
+    std::tuple<double, uint64_t> calculate_congestion();
+    /** M/D/1 queueing on every port with a bandwidth, utilization from the system wide traffic share of the port and
+     * the delay charged to the target's misses through it, in ns */
+    double calculate_queueing(const LatencyPass &lat, const BandwidthPass &bw);
+    /** per port utilization and queueing delay of the last epoch */
+    std::string port_output() const;
+
+private:
+    void visit(CXLSwitch *node, int parent);
+};
+
+#endif // CXLMEMSIM_CXLTOPOLOGY_H
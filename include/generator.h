@@ -0,0 +1,53 @@
+#ifndef CXLMEMSIM_GENERATOR_H
+#define CXLMEMSIM_GENERATOR_H
+
+#include "samplebatch.h"
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <vector>
+
+enum gen_pattern { GEN_UNIFORM, GEN_ZIPF, GEN_SEQUENTIAL, GEN_CHASE };
+
+/** One phase of a synthetic stream, the footprint is cut into stride sized items */
+struct GeneratorPhase {
+    enum gen_pattern pattern = GEN_UNIFORM;
+    uint64_t samples = 1000000;
+    uint64_t footprint = 1024 * 1024 * 1024; // bytes
+    uint64_t stride = 64;
+    double theta = 0.99; // zipf skew
+    double write_ratio = 0; // the share of stores
+};
+
+/** Synthetic sample streams for driving the model without a PMU: uniform, zipfian, sequential and pointer chasing
+ * phases played one after the other at a fixed sample rate */
+class Generator {
+public:
+    static constexpr uint64_t base = 0x7f0000000000; // where the footprint starts, virtual
+    static constexpr uint64_t phys_base = 0x100000000;
+
+    Generator(std::vector<GeneratorPhase> phases, uint64_t rate, uint64_t seed);
+    /** clear batch and fill it with the next n samples or what is left, return false once every phase is done */
+    bool next(SampleBatch &batch, size_t n);
+    /** phases separated by ';', each a pattern then comma separated key=value, e.g. "ld;zipf,n=1M,f=256M,t=0.9,w=0.3".
+     * Patterns are uniform, zipf, seq and chase plus the presets ld, st and ptr-chasing after the microbenchmarks;
+     * keys n samples, f footprint, s stride, t theta, w write ratio, sizes take K, M and G */
+    static std::optional<std::vector<GeneratorPhase>> parse(const std::string &spec);
+
+private:
+    std::vector<GeneratorPhase> phases;
+    double period; // ns between samples
+    double timestamp = 0;
+    uint64_t state;
+    size_t phase = 0;
+    uint64_t done = 0; // samples of the phase so far
+    uint64_t items = 1;
+    uint64_t cursor = 0; // the sequential position or the chase hop
+    std::vector<uint32_t> chain; // the chase permutation, a single cycle
+    double zeta_n = 0, alpha = 0, eta = 0; // zipf constants of the phase
+    void start_phase();
+    uint64_t random();
+    uint64_t zipf();
+};
+
+#endif // CXLMEMSIM_GENERATOR_H
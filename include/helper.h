@@ -28,6 +28,7 @@ enum { CPU_MDL_BDX = 63, CPU_MDL_SKX = 85, CPU_MDL_SPR = 143, CPU_MDL_ADL = 151,
 class Incore;
 class Uncore;
 class Helper;
+class PerfmonCatalog;
 
 struct PerfConfig {
     std::string path_format_cha_type{};
@@ -70,9 +71,15 @@ struct CPUElem {
     std::array<uint64_t, 4> cpu;
 };
 
+/* the access a sample reports, the same codes CXLEndPoint::insert returns; unknown falls back to first touch is a
+ * store, later touches are loads */
+enum { ACCESS_UNKNOWN = 0, ACCESS_STORE = 1, ACCESS_LOAD = 2 };
+
 struct PEBSElem {
     uint64_t total;
     uint64_t llcmiss;
+    uint64_t lost; // from PERF_RECORD_LOST, the ring was full
+    uint64_t lost_samples; // from PERF_RECORD_LOST_SAMPLES, dropped by the PMU
 };
 
 struct CPUInfo {
@@ -91,11 +98,19 @@ struct Elem {
 
 class PMUInfo {
 public:
-    std::vector<Uncore> chas;
+    std::vector<Uncore> chas; // every CHA of every socket once, socket major
     std::vector<Incore> cpus;
     Helper *helper;
+    std::vector<CHAElem> cha_last; // the last read_chas
+    std::vector<CHAElem> cha_delta; // since the read before it
+    std::vector<CPUElem> cpu_last; // the same for read_cpus
+    std::vector<CPUElem> cpu_delta;
     PMUInfo(pid_t pid, Helper *h, struct PerfConfig *perf_config);
     ~PMUInfo();
+    /** read every CHA once for the epoch, the monitors get their share of cha_delta */
+    int read_chas();
+    /** read every CPU once for the epoch, only the trace needs these machine wide */
+    int read_cpus();
     int start_all_pmcs();
     int stop_all_pmcs();
     int freeze_counters_cha_all();
@@ -109,14 +124,20 @@ public:
     int cpu;
     int cha;
     std::vector<int> used_cpu;
-    std::vector<int> used_cha;
+    std::vector<int> used_cha; // CHA units, socket * cha + the CHA index
+    std::vector<int> socket_cpu; // the cpu the uncore events of each socket are opened on
     int num_of_cpu();
     int num_of_cha();
+    /** the uncore PMU's cpumask, one cpu per socket */
+    static std::vector<int> uncore_cpus();
     static void detach_children();
     static void noop_handler(int signum);
     double cpu_frequency();
+    /** the four CHA then four CPU slots from the names and raw configs, a name found in catalog takes its config from
+     * there. With a catalog a model missing from model_ctx runs too */
     PerfConfig detect_model(uint32_t model, const std::vector<std::string> &perf_name,
-                            const std::vector<uint64_t> &perf_conf1, const std::vector<uint64_t> &perf_conf2);
+                            const std::vector<uint64_t> &perf_conf1, const std::vector<uint64_t> &perf_conf2,
+                            const PerfmonCatalog *catalog = nullptr);
 };
 
 #endif // CXLMEMSIM_HELPER_H
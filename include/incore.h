@@ -18,13 +18,14 @@ union CPUID_INFO {
 /** This is a per cha metrics*/
 class Incore {
 public:
-    std::array<PerfInfo *, 4> perf{nullptr}; // should only be 4 counters
+    std::array<PerfInfo *, 4> perf{nullptr}; // should only be 4 counters, one group led by perf[0]
     struct PerfConfig *perf_config;
     Incore(pid_t pid, int cpu, struct PerfConfig *perf_config);
     ~Incore() = default;
     int start();
     int stop();
 
+    /** all four counters in one read of the group */
     ssize_t read_cpu_elems(struct CPUElem *cpu_elem);
 };
 
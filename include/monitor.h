@@ -33,8 +33,20 @@ class Monitors {
 public:
     std::vector<Monitor> mon;
     bool print_flag;
+    size_t pebs_ring_size = PEBS::min_ring_size; // bytes, a power of two
+    uint64_t store_sample_period = 10000; // the base period of the store events
+    std::vector<int> drain_cpus; // cores for the PEBS drain threads, empty to drain at the epoch boundary
+    size_t drain_queue_size = 65536;
+    /* cpu wide mode: one PEBS event per target core instead of one per task, samples kept through the filter */
+    bool cpu_wide = false;
+    TaskFilter filter;
+    std::vector<PEBS *> cpu_pebs;
+    SampleBatch cpu_wide_batch;
+    PEBSElem cpu_wide_elem{};
+    uint64_t cpu_wide_decode_ns = 0; // the last read_cpu_wide
+    uint64_t cpu_wide_ingest_ns = 0;
     Monitors(int tnum, cpu_set_t *use_cpuset);
-    ~Monitors() = default;
+    ~Monitors();
 
     void stop_all(int);
     void run_all(int);
@@ -44,6 +56,16 @@ public:
     int terminate(uint32_t, uint32_t, int32_t);
     bool check_all_terminated(uint32_t);
     bool check_continue(uint32_t, struct timespec);
+    /** open one PEBS event on every core a target can run on */
+    void enable_cpu_wide(uint64_t pebs_sample_period);
+    /** merge the samples of every cpu in time order and feed them to the controller in one batch */
+    int read_cpu_wide(CXLController *);
+    /** retune every cpu event to one shared load and one shared store period, each toward budget sample records per
+     * epoch over all cpus, so the merged batch keeps a single weight per kind. Return the load period now in effect */
+    uint64_t adapt_cpu_wide(uint64_t budget);
+    /** split the epoch's CHA deltas among the monitors by the PEBS samples each took, evenly when none has samples
+     * as in cpu wide mode, into after = before + share */
+    void attribute_chas(const std::vector<CHAElem> &delta);
 };
 
 class Monitor {
@@ -61,6 +83,7 @@ public:
     struct timespec start_exec_ts, end_exec_ts;
     bool is_process;
     struct PEBS *pebs_ctx;
+    uint64_t epoch_samples = 0; // taken this epoch, its share of the uncore traffic
 
     explicit Monitor();
 
@@ -0,0 +1,122 @@
+#ifndef CXLMEMSIM_OCCUPATION_H
+#define CXLMEMSIM_OCCUPATION_H
+
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <utility>
+#include <unordered_map>
+#include <vector>
+
+/** One record per granularity unit */
+struct OccupationEntry {
+    uint64_t first_touch;
+    uint64_t last_touch;
+    uint64_t address; // unit base
+    uint64_t virt_addr; // the last virtual unit that touched it
+    uint32_t reads;
+    uint32_t writes;
+    uint32_t prev;
+    uint32_t next;
+};
+
+/** Dual indexed occupation: an address keyed hash table for lookup plus a time ordered intrusive list threaded
+ * through a slot vector. Insert, touch and eviction of the oldest entry are amortized O(1); freed slots are
+ * recycled so a steady working set does not allocate. An ordered address index, only touched when an address
+ * first appears or leaves, lets a [begin, end) range be dropped in O(log n + k). Addresses are aggregated into
+ * units of the configured granularity, so one record covers a whole cacheline, page or hugepage. */
+class Occupation {
+public:
+    static constexpr uint32_t npos = UINT32_MAX;
+
+    class iterator {
+    public:
+        iterator(const Occupation *occ, uint32_t slot) : occ(occ), slot(slot) {}
+        const OccupationEntry &operator*() const { return occ->entries[slot]; }
+        const OccupationEntry *operator->() const { return &occ->entries[slot]; }
+        iterator &operator++() {
+            slot = occ->entries[slot].next;
+            return *this;
+        }
+        bool operator==(const iterator &other) const { return slot == other.slot; }
+        bool operator!=(const iterator &other) const { return slot != other.slot; }
+
+    private:
+        const Occupation *occ;
+        uint32_t slot;
+    };
+
+    Occupation() = default;
+    /** set the unit size in bytes, a power of two, before anything is inserted */
+    void set_granularity(uint64_t bytes) { mask = ~(bytes - 1); }
+    uint64_t unit(uint64_t address) const { return address & mask; }
+    /** touch the unit holding address, the flag is true if it was already present. The record stays valid until the
+     * next insert */
+    std::pair<OccupationEntry *, bool> insert(uint64_t timestamp, uint64_t address, uint64_t virt_addr = 0);
+    bool erase(uint64_t address);
+    /** drop every unit wholly inside [begin, end), one only partly covered stays. on_erase sees each entry before it
+     * goes, return the number removed */
+    template <typename F> size_t erase_range(uint64_t begin, uint64_t end, F &&on_erase) {
+        size_t removed = 0;
+        auto [first, last] = covered(ordered, begin, end);
+        for (auto it = first; it != last; ++it) {
+            on_erase(entries[it->second]);
+            release(it->second);
+            index.erase(it->first);
+            removed++;
+        }
+        ordered.erase(first, last);
+        return removed;
+    }
+    size_t erase_range(uint64_t begin, uint64_t end) {
+        return erase_range(begin, end, [](const OccupationEntry &) {});
+    }
+    /** the entries of a map keyed by unit base whose unit lies wholly inside [begin, end), as a [first, last) pair */
+    template <typename Map> auto covered(Map &map, uint64_t begin, uint64_t end) const {
+        auto from = unit(begin + ~mask); // the first unit starting at or after begin
+        auto first = from < begin ? map.end() : map.lower_bound(from);
+        auto last = first;
+        while (last != map.end() && (last->first < end) && end - last->first > ~mask) {
+            ++last;
+        }
+        return std::pair{first, last};
+    }
+    bool contains(uint64_t address) const;
+    /** drop the least recently touched entry, return false if empty */
+    bool evict_oldest();
+    const OccupationEntry *oldest() const;
+    /** Drop from the oldest end every entry last touched before cutoff, then until at most budget remain (0 for
+     * unbounded). on_evict sees each entry before it goes, return the number dropped */
+    template <typename F> size_t age_out(uint64_t cutoff, size_t budget, F &&on_evict) {
+        size_t dropped = 0;
+        while (head != npos && (entries[head].last_touch < cutoff || (budget != 0 && count > budget))) {
+            on_evict(entries[head]);
+            evict_oldest();
+            dropped++;
+        }
+        return dropped;
+    }
+    void reserve(size_t n);
+    void clear();
+    size_t size() const { return count; }
+    bool empty() const { return count == 0; }
+    iterator begin() const { return {this, head}; } // oldest first
+    iterator end() const { return {this, npos}; }
+
+private:
+    std::vector<OccupationEntry> entries;
+    std::unordered_map<uint64_t, uint32_t> index; // address, slot
+    std::map<uint64_t, uint32_t> ordered; // address, slot
+    uint64_t mask = ~0ULL;
+    uint32_t head = npos; // oldest
+    uint32_t tail = npos; // newest
+    uint32_t free_slot = npos;
+    size_t count = 0;
+
+    uint32_t alloc_slot();
+    void link_tail(uint32_t slot);
+    void unlink(uint32_t slot);
+    void release(uint32_t slot);
+};
+
+#endif // CXLMEMSIM_OCCUPATION_H
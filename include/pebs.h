@@ -7,38 +7,127 @@
 
 #include "cxlcontroller.h"
 #include "helper.h"
+#include "samplebatch.h"
+#include "spscqueue.h"
 #include <asm/unistd.h>
 #include <cerrno>
 #include <csignal>
+#include <array>
+#include <atomic>
 #include <cstdint>
 #include <cstdio>
 #include <cstdlib>
 #include <cstring>
 #include <ctime>
 #include <fcntl.h>
+#include <memory>
+#include <shared_mutex>
 #include <sys/ioctl.h>
 #include <sys/mman.h>
 #include <sys/syscall.h>
 #include <sys/types.h>
 #include <sys/wait.h>
+#include <thread>
 #include <unistd.h>
+#include <unordered_set>
 #include <x86intrin.h>
 
 long perf_event_open(struct perf_event_attr *event_attr, pid_t pid, int cpu, int group_fd, unsigned long flags);
+
+/** The tasks a CPU wide event keeps samples of: every thread of a tracked process plus single tracked threads. The
+ * monitor thread updates it while drain threads read it */
+class TaskFilter {
+public:
+    std::shared_mutex mutex;
+    std::unordered_set<uint32_t> processes;
+    std::unordered_set<uint32_t> threads;
+    void add(uint32_t tgid, uint32_t tid, bool is_process) {
+        std::unique_lock lock(mutex);
+        is_process ? processes.insert(tgid) : threads.insert(tid);
+    }
+    void remove(uint32_t tgid, uint32_t tid, bool is_process) {
+        std::unique_lock lock(mutex);
+        is_process ? processes.erase(tgid) : threads.erase(tid);
+    }
+    /** the caller holds the mutex shared */
+    bool contains(uint32_t pid, uint32_t tid) const { return processes.contains(pid) || threads.contains(tid); }
+};
+
 class PEBS {
 public:
+    static constexpr size_t min_ring_size = 64 * 1024;
+    static constexpr size_t max_ring_size = 16 * 1024 * 1024;
+    static constexpr uint64_t min_period = 16; // bounds of the adaptive period
+    static constexpr uint64_t max_period = 1 << 24;
     int fd;
+    int store_fd = -1; // retired stores, writing into fd's ring; -1 when the cpu cannot sample them
+    uint64_t store_id = 0; // PERF_SAMPLE_ID of the store event's records
     int pid;
+    int cpu; // -1 follows the task, otherwise the event samples everything on this cpu through the filter
+    TaskFilter *filter;
     uint64_t sample_period;
+    uint64_t base_period; // the configured period, a sample taken at it counts as one access
+    /* stores retire far more often than L3 missing loads, so their event runs at a period of its own */
+    uint64_t store_period;
+    uint64_t store_base_period;
     uint32_t seq{};
     size_t rdlen{};
     size_t mplen{};
+    size_t data_size; // the ring after the header page, a power of two
     struct perf_event_mmap_page *mp;
-    PEBS(pid_t, uint64_t);
+    alignas(8) std::array<char, UINT16_MAX + 1> scratch{}; // a record that wraps the ring is copied out here
+    SampleBatch batch; // the samples of the last read
+    uint64_t decode_ns = 0; // time spent on the last read draining the ring and feeding the model
+    uint64_t ingest_ns = 0;
+    /* optional drain thread: it owns the ring and hands decoded samples over the queue */
+    std::thread drain_thread;
+    std::atomic<bool> draining{false};
+    std::unique_ptr<SPSCQueue<Sample>> queue;
+    std::atomic<uint64_t> drain_lost{0}; // not yet collected by read
+    std::atomic<uint64_t> drain_lost_samples{0};
+    std::atomic<uint64_t> drain_llcmiss{0};
+    std::atomic<uint64_t> drain_overflow{0}; // samples dropped because the queue was full
+    std::atomic<uint64_t> drain_high_water{0};
+    std::atomic<uint64_t> drain_latency_ns{0}; // worst sample to queue latency since the last read
+    /* since the last adapt_period, filtered out samples included since they cost the same */
+    std::atomic<uint64_t> records{0};
+    std::atomic<uint64_t> store_records{0};
+    std::atomic<uint64_t> throttles{0};
+    PEBS(pid_t, uint64_t, uint64_t store_period, size_t data_size = min_ring_size, int cpu = -1,
+         TaskFilter *filter = nullptr);
     ~PEBS();
+    /** feed the samples since the last read to the controller in one batch, from the ring or from the drain queue.
+     * The lost record counts accumulate in the elem, and the batch weight makes up for the ones of this read */
     int read(CXLController *, struct PEBSElem *);
+    /** append the samples since the last call to out without feeding the model */
+    int collect(SampleBatch &out, struct PEBSElem *elem);
+    /** start draining on a thread pinned to cpu (-1 for anywhere) into a queue of queue_size samples */
+    void start_drain(int cpu, size_t queue_size);
+    void stop_drain();
+    /** retune the running load and store events, effective from their next overflow */
+    int set_period(uint64_t period, uint64_t store_period_);
+    /** move the load and the store period each toward budget sample records per epoch, from their records since the
+     * last call. 0 keeps the periods. Return the load period now in effect */
+    uint64_t adapt_period(uint64_t budget);
+    /** accesses a sample taken at the current period stands for */
+    double weight() const { return (double)sample_period / (double)base_period; }
+    double store_weight() const { return (double)store_period / (double)store_base_period; }
+    /** every sample that reached the model stands for (taken + dropped) / taken of them */
+    static double loss_scale(uint64_t taken, uint64_t dropped) {
+        return taken != 0 ? (double)(taken + dropped) / (double)taken : 1.;
+    }
+    /** one multiplicative step of at most 2x toward budget, faster when the kernel throttled the event */
+    static uint64_t next_period(uint64_t period, uint64_t records, uint64_t budget, bool throttled);
+    static bool valid_ring_size(size_t size) {
+        return size >= min_ring_size && size <= max_ring_size && (size & (size - 1)) == 0;
+    }
     int start();
     int stop();
+
+private:
+    /** decode every record up to data_head into out and hand the space back */
+    int decode(SampleBatch &out, struct PEBSElem *elem);
+    void drain(int cpu);
 };
 
 #endif // CXLMEMSIM_PEBS_H
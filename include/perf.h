@@ -35,10 +35,19 @@ public:
     PerfInfo(int group_fd, int cpu, pid_t pid, unsigned long flags, struct perf_event_attr attr);
     ~PerfInfo();
     ssize_t read_pmu(uint64_t *value);
+    /** one read() for the leader and every member in creation order, scaled up when the group was multiplexed. The
+     * event must lead a PERF_FORMAT_GROUP group of at most max_group events */
+    ssize_t read_group(uint64_t *values, size_t n);
+    /** a group leader enables and disables its members in the same ioctl */
     int start();
     int stop();
+    static constexpr size_t max_group = 8;
+    static constexpr uint64_t group_format =
+        PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
 };
 
-PerfInfo *init_incore_perf(const pid_t pid, const int cpu, uint64_t conf, uint64_t conf1);
-PerfInfo *init_uncore_perf(const pid_t pid, const int cpu, uint64_t conf, uint64_t conf1, int value);
+/** group_fd -1 opens a group leader, otherwise a member of that group */
+PerfInfo *init_incore_perf(const pid_t pid, const int cpu, uint64_t conf, uint64_t conf1, int group_fd = -1);
+PerfInfo *init_uncore_perf(const pid_t pid, const int cpu, uint64_t conf, uint64_t conf1, int value,
+                           int group_fd = -1);
 #endif // CXLMEMSIM_PERF_H
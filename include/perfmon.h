@@ -0,0 +1,42 @@
+#ifndef CXLMEMSIM_PERFMON_H
+#define CXLMEMSIM_PERFMON_H
+
+#include <cstdint>
+#include <filesystem>
+#include <optional>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+/** One event resolved to the raw perf_event_attr encoding */
+struct PerfmonEvent {
+    uint64_t config;
+    uint64_t config1;
+    bool uncore;
+};
+
+/** Intel perfmon JSON event files (github.com/intel/perfmon) resolved for one CPU model. The resolved table is kept
+ * in a binary cache next to the files, so a later start with the same files does no JSON parsing at all */
+class PerfmonCatalog {
+public:
+    static constexpr char magic[8] = {'C', 'X', 'L', 'P', 'M', 'O', 'N', '1'};
+    uint32_t model = 0;
+    std::unordered_map<std::string, PerfmonEvent> events; // upper case event name
+    bool from_cache = false;
+
+    /** the files for model from dir's mapfile.csv, or every json in dir when there is none. cache empty keeps it in
+     * dir. Return false when no event was found */
+    bool load(const std::string &dir, uint32_t model, std::string cache = "");
+    /** case insensitive, perfmon names such as MEM_LOAD_RETIRED.L3_MISS */
+    std::optional<PerfmonEvent> find(const std::string &name) const;
+
+private:
+    static std::vector<std::filesystem::path> files(const std::filesystem::path &dir, uint32_t model);
+    /** changes whenever one of the files does */
+    static uint64_t stamp(const std::vector<std::filesystem::path> &files, uint32_t model);
+    void parse(const std::filesystem::path &file, bool uncore);
+    bool load_cache(const std::string &path, uint64_t stamp);
+    bool save_cache(const std::string &path, uint64_t stamp) const;
+};
+
+#endif // CXLMEMSIM_PERFMON_H
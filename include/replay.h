@@ -0,0 +1,47 @@
+#ifndef CXLMEMSIM_REPLAY_H
+#define CXLMEMSIM_REPLAY_H
+
+#include "cxlcontroller.h"
+#include "trace.h"
+#include <cstdint>
+#include <string>
+#include <vector>
+
+struct ReplayEpoch {
+    uint64_t epoch;
+    uint64_t samples;
+    uint64_t delay; // ns, summed over the monitors
+    uint64_t charges; // the monitors the delay was computed for
+};
+
+struct ReplayResult {
+    std::vector<ReplayEpoch> epochs;
+    uint64_t samples = 0;
+    uint64_t delay = 0;
+    uint64_t elapsed_ns = 0; // the replay itself
+    bool ok = false; // the replay ran to the end of the trace without a corrupt sample record
+};
+
+/** one configuration of a sweep, label is how the table names it */
+struct SweepPoint {
+    ControllerConfig config;
+    double dramlatency;
+    std::string label;
+};
+
+/** the delay the epoch loop in main.cc injects into one monitor once its samples are in, the replay passes none of
+ * the counter based terms */
+uint64_t epoch_delay(CXLController *controller, double dramlatency, uint64_t readonly = 0, uint64_t writeback = 0,
+                     uint64_t read_config = 0);
+
+/** Feed a recorded trace through controller the way the live epoch loop does, every sample record inserted, every
+ * monitor's record charged and every epoch record aging the occupation out, at full speed and with no target or perf
+ * fd. Packed blocks are decoded and inserted one at a time, from the first sample record of from_epoch */
+ReplayResult replay(const TraceReader &trace, CXLController *controller, double dramlatency,
+                    uint64_t from_epoch = 0);
+
+/** Replay the one mapped trace through every point on a pool of threads, each point with a controller of its own.
+ * The results are in the order of points, a point whose controller could not be built or replayed is not ok */
+std::vector<ReplayResult> sweep(const TraceReader &trace, const std::vector<SweepPoint> &points, int threads);
+
+#endif // CXLMEMSIM_REPLAY_H
@@ -0,0 +1,82 @@
+#ifndef CXLMEMSIM_SAMPLEBATCH_H
+#define CXLMEMSIM_SAMPLEBATCH_H
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <numeric>
+#include <vector>
+
+/** One decoded memory sample, the element handed between threads */
+struct Sample {
+    uint64_t timestamp;
+    uint64_t virt_addr;
+    uint64_t phys_addr;
+    uint32_t tid;
+    uint8_t type; // ACCESS_LOAD, ACCESS_STORE or ACCESS_UNKNOWN
+};
+
+/** Structure of arrays buffer of decoded memory samples, reused across epochs so steady state decoding does not
+ * allocate */
+struct SampleBatch {
+    std::vector<uint64_t> timestamp;
+    std::vector<uint64_t> virt_addr;
+    std::vector<uint64_t> phys_addr;
+    std::vector<uint32_t> tid;
+    std::vector<uint8_t> type;
+    double weight = 1; // accesses each sample stands for: the period over the base period, scaled up for drops
+    double store_weight = 1; // the same for the store samples, whose event has a period of its own
+
+    size_t size() const { return timestamp.size(); }
+    bool empty() const { return timestamp.empty(); }
+    void clear() {
+        timestamp.clear();
+        virt_addr.clear();
+        phys_addr.clear();
+        tid.clear();
+        type.clear();
+    }
+    void reserve(size_t n) {
+        timestamp.reserve(n);
+        virt_addr.reserve(n);
+        phys_addr.reserve(n);
+        tid.reserve(n);
+        type.reserve(n);
+    }
+    void push_back(uint64_t timestamp_, uint64_t virt_addr_, uint64_t phys_addr_, uint32_t tid_, uint8_t type_) {
+        timestamp.push_back(timestamp_);
+        virt_addr.push_back(virt_addr_);
+        phys_addr.push_back(phys_addr_);
+        tid.push_back(tid_);
+        type.push_back(type_);
+    }
+    /** stable sort by timestamp, for batches gathered from several per cpu rings */
+    void sort_by_time() {
+        if (std::is_sorted(timestamp.begin(), timestamp.end())) {
+            return;
+        }
+        std::vector<uint32_t> order(size());
+        std::iota(order.begin(), order.end(), 0);
+        std::stable_sort(order.begin(), order.end(),
+                         [this](uint32_t a, uint32_t b) { return timestamp[a] < timestamp[b]; });
+        permute(timestamp, order);
+        permute(virt_addr, order);
+        permute(phys_addr, order);
+        permute(tid, order);
+        permute(type, order);
+    }
+    void push_back(const Sample &sample) {
+        push_back(sample.timestamp, sample.virt_addr, sample.phys_addr, sample.tid, sample.type);
+    }
+
+private:
+    template <typename T> static void permute(std::vector<T> &column, const std::vector<uint32_t> &order) {
+        std::vector<T> sorted(column.size());
+        for (size_t i = 0; i < order.size(); i++) {
+            sorted[i] = column[order[i]];
+        }
+        column.swap(sorted);
+    }
+};
+
+#endif // CXLMEMSIM_SAMPLEBATCH_H
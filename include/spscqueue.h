@@ -0,0 +1,60 @@
+#ifndef CXLMEMSIM_SPSCQUEUE_H
+#define CXLMEMSIM_SPSCQUEUE_H
+
+#include <atomic>
+#include <cstddef>
+#include <vector>
+
+/** Bounded lock free single producer single consumer ring. Each side keeps a cached copy of the other's index on its
+ * own cacheline, so the shared indices are only reloaded when the ring looks full or empty. */
+template <typename T> class SPSCQueue {
+public:
+    /** capacity is rounded up to a power of two */
+    explicit SPSCQueue(size_t capacity) {
+        size_t size = 1;
+        while (size < capacity) {
+            size <<= 1;
+        }
+        buffer.resize(size);
+        mask = size - 1;
+    }
+    /** producer side, false if the ring is full */
+    bool try_push(const T &value) {
+        auto tail = tail_.load(std::memory_order_relaxed);
+        if (tail - head_cache == buffer.size()) {
+            head_cache = head_.load(std::memory_order_acquire);
+            if (tail - head_cache == buffer.size()) {
+                return false;
+            }
+        }
+        buffer[tail & mask] = value;
+        tail_.store(tail + 1, std::memory_order_release);
+        return true;
+    }
+    /** consumer side, false if the ring is empty */
+    bool try_pop(T &value) {
+        auto head = head_.load(std::memory_order_relaxed);
+        if (head == tail_cache) {
+            tail_cache = tail_.load(std::memory_order_acquire);
+            if (head == tail_cache) {
+                return false;
+            }
+        }
+        value = buffer[head & mask];
+        head_.store(head + 1, std::memory_order_release);
+        return true;
+    }
+    /** approximate when read from the other side */
+    size_t size() const { return tail_.load(std::memory_order_acquire) - head_.load(std::memory_order_acquire); }
+    size_t capacity() const { return buffer.size(); }
+
+private:
+    std::vector<T> buffer;
+    size_t mask;
+    alignas(64) std::atomic<size_t> head_{0}; // consumer
+    size_t tail_cache = 0;
+    alignas(64) std::atomic<size_t> tail_{0}; // producer
+    size_t head_cache = 0;
+};
+
+#endif // CXLMEMSIM_SPSCQUEUE_H
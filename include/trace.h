@@ -0,0 +1,146 @@
+#ifndef CXLMEMSIM_TRACE_H
+#define CXLMEMSIM_TRACE_H
+
+#include "helper.h"
+#include "samplebatch.h"
+#include <cstdint>
+#include <span>
+#include <string>
+#include <vector>
+
+/* A trace is the header followed by 8 byte aligned records, each a TraceRecord and its payload, so a reader maps the
+ * file and walks it in place. Every epoch writes its sample records, one per monitor the epoch charged a delay to,
+ * then one TRACE_EPOCH. The samples of a monitor are either one TRACE_SAMPLES or, packed, a run of TRACE_BLOCK. In
+ * cpu wide mode the samples of all monitors come first under TRACE_CPU_WIDE and every monitor's record is empty. A
+ * closed version 2 trace ends with a TRACE_INDEX of its sample records */
+enum trace_kind : uint32_t { TRACE_SAMPLES = 1, TRACE_EPOCH = 2, TRACE_BLOCK = 3, TRACE_INDEX = 4 };
+// 1 had no blocks and no index, 2 charged the TRACE_CPU_WIDE record once, 3 had one weight for loads and stores
+constexpr uint32_t TRACE_VERSION = 4;
+constexpr uint32_t TRACE_BLOCK_LAST = 1; // the block ends its monitor's samples of the epoch
+constexpr uint32_t TRACE_CPU_WIDE = UINT32_MAX; // the monitor of the samples from the per cpu rings
+
+struct TraceHeader {
+    char magic[8]; // CXLTRACE
+    uint32_t version;
+    uint32_t header_size;
+    uint32_t cpu_model;
+    uint32_t interval; // epoch in ms
+    uint64_t period; // the PEBS base period
+    uint64_t epochs; // the counts are filled in on close, 0 for a trace that was not closed
+    uint64_t samples;
+    uint64_t records;
+    uint64_t index; // offset of the TRACE_INDEX record, 0 for none
+};
+static_assert(sizeof(TraceHeader) == 64);
+
+struct TraceRecord {
+    uint32_t kind;
+    uint32_t size; // of the payload after it
+};
+
+/** followed by the timestamp, virt_addr, phys_addr, tid and type columns of count samples, each padded to 8 bytes */
+struct TraceSamples {
+    uint64_t epoch;
+    uint32_t monitor; // index in Monitors::mon or TRACE_CPU_WIDE
+    uint32_t count;
+    double weight;
+    double store_weight;
+};
+
+/** followed by the timestamp, virt_addr, phys_addr and tid columns as LEB128 varints of the zigzag delta to the
+ * previous sample of the block, then the types 2 bits each */
+struct TraceBlock {
+    uint64_t epoch;
+    uint32_t monitor;
+    uint32_t count;
+    double weight;
+    double store_weight;
+    uint32_t flags;
+    uint32_t size[4]; // bytes of the four varint columns
+    uint32_t reserved;
+};
+
+/** one per sample record, TRACE_INDEX is an array of them in file order */
+struct TraceIndexEntry {
+    uint64_t offset;
+    uint64_t epoch;
+    uint64_t timestamp; // of the first sample, 0 for none
+};
+
+/** followed by chas CHAElem then cpus CPUElem, the counter deltas of the epoch */
+struct TraceEpoch {
+    uint64_t epoch;
+    uint64_t timestamp; // CLOCK_MONOTONIC ns
+    uint32_t chas;
+    uint32_t cpus;
+};
+
+/** Appends to a trace through a large buffer, optionally with O_DIRECT, and keeps the time it spent so the recording
+ * overhead can be reported */
+class TraceWriter {
+public:
+    static constexpr size_t buffer_size = 4 * 1024 * 1024;
+    static constexpr size_t block_size = 4096; // O_DIRECT writes whole blocks from an aligned buffer
+    static constexpr size_t block_samples = 65536; // the most samples per packed block
+    TraceHeader header{};
+    uint64_t bytes = 0;
+    uint64_t write_ns = 0; // spent in samples, epoch and close
+    uint64_t open_ns = 0; // CLOCK_MONOTONIC at open, for the overhead ratio
+
+    /** packed writes the samples as TRACE_BLOCK instead of TRACE_SAMPLES */
+    TraceWriter(const std::string &path, uint32_t cpu_model, uint32_t interval, uint64_t period, bool direct,
+                bool packed = false);
+    ~TraceWriter();
+    bool ok() const { return fd >= 0; }
+    /** empty batches are kept too, a monitor that took no sample still had its delay computed */
+    void samples(uint64_t epoch, uint32_t monitor, const SampleBatch &batch);
+    void epoch(uint64_t epoch, const std::vector<CHAElem> &chas, const std::vector<CPUElem> &cpus);
+    /** flush the buffer and write the final header, later calls do nothing */
+    void close();
+
+private:
+    int fd = -1;
+    bool direct;
+    bool packed;
+    char *buf = nullptr;
+    size_t used = 0;
+    std::vector<TraceIndexEntry> entries;
+    std::vector<uint8_t> scratch; // the packed block being built
+    void block(uint64_t epoch, uint32_t monitor, const SampleBatch &batch, size_t first, size_t count, bool last);
+    void append(const void *data, size_t size);
+    void pad();
+    bool flush(bool final);
+};
+
+/** A mapped trace, validated up front and walked record by record. The walk state is the caller's offset, so any
+ * number of threads can walk one mapping */
+class TraceReader {
+public:
+    const TraceHeader *header = nullptr;
+
+    explicit TraceReader(const std::string &path);
+    ~TraceReader();
+    bool ok() const { return header != nullptr; }
+    /** the offset of the first record */
+    size_t begin() const { return header != nullptr ? header->header_size : length; }
+    /** the sample records by offset, empty when the trace was not closed or is version 1 */
+    std::span<const TraceIndexEntry> index() const;
+    /** the offset of the first sample record of epoch or later, found through the index when there is one */
+    size_t seek(uint64_t epoch) const;
+    /** the record at offset and advance it, nullptr at the end, at a record cut short by a crash or at one too short
+     * for the head of its kind */
+    const TraceRecord *next(size_t &offset) const;
+    static const void *payload(const TraceRecord *record) { return record + 1; }
+    /** the monitor of a TRACE_SAMPLES or TRACE_BLOCK record, the two start alike */
+    static uint32_t monitor(const TraceRecord *record) { return ((const TraceSamples *)payload(record))->monitor; }
+    /** copy a TRACE_SAMPLES or decode a TRACE_BLOCK record into batch, weights included. Return 1 if it was the last
+     * record of the monitor's samples for the epoch, 0 if more follow and -1, with batch empty, if the samples do not
+     * fit the record */
+    int samples(const TraceRecord *record, SampleBatch &batch) const;
+
+private:
+    const char *map = nullptr;
+    size_t length = 0;
+};
+
+#endif // CXLMEMSIM_TRACE_H
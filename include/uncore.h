@@ -14,11 +14,15 @@ class Uncore {
 public:
     uint32_t unc_idx{};
     int fd{};
-    std::array<PerfInfo *, 4> perf{nullptr, nullptr, nullptr, nullptr};
-    Uncore(uint32_t unc_idx, PerfConfig *perf_config);
+    std::array<PerfInfo *, 4> perf{nullptr, nullptr, nullptr, nullptr}; // one group led by perf[0]
+    /** the CHA unc_idx of the socket that cpu belongs to */
+    Uncore(uint32_t unc_idx, int cpu, PerfConfig *perf_config);
 
     ~Uncore() = default;
+    int start();
+    int stop();
 
+    /** all four counters in one read of the group */
     int read_cha_elems(struct CHAElem *elem);
 };
 
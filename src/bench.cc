@@ -0,0 +1,289 @@
+/** Micro benchmarks for the simulator core, no PMU or target process needed */
+#include "cxlendpoint.h"
+#include "cxlkernel.h"
+#include "helper.h"
+#include "trace.h"
+#include <atomic>
+#include <chrono>
+#include <cxxopts.hpp>
+#include <list>
+#include <new>
+
+Helper helper{};
+
+/** Count heap allocations so the benchmarks can report allocations per operation */
+static std::atomic<uint64_t> allocations{0};
+void *operator new(size_t size) {
+    allocations.fetch_add(1, std::memory_order_relaxed);
+    if (void *p = malloc(size)) {
+        return p;
+    }
+    throw std::bad_alloc();
+}
+void operator delete(void *p) noexcept { free(p); }
+void operator delete(void *p, size_t) noexcept { free(p); }
+
+struct BenchConfig {
+    uint64_t samples;
+    uint64_t footprint;
+};
+
+static uint64_t xorshift(uint64_t &state) {
+    state ^= state << 13;
+    state ^= state >> 7;
+    state ^= state << 17;
+    return state;
+}
+
+template <typename F> static double samples_per_sec(uint64_t samples, F &&f) {
+    auto start = std::chrono::steady_clock::now();
+    f();
+    auto end = std::chrono::steady_clock::now();
+    return (double)samples / std::chrono::duration<double>(end - start).count();
+}
+
+/** The previous CXLMemExpander::insert path: a timestamp keyed map scanned for the address on every sample */
+static int legacy_insert(std::map<uint64_t, uint64_t> &occupation, uint64_t timestamp, uint64_t phys_addr) {
+    for (auto it = occupation.cbegin(); it != occupation.cend(); it++) {
+        if ((*it).second == phys_addr) {
+            occupation.erase(it);
+            occupation.emplace(timestamp, phys_addr);
+            return 2;
+        }
+    }
+    occupation.emplace(timestamp, phys_addr);
+    return 1;
+}
+
+/** The previous node based LRUCache: std::list plus two std::unordered_map */
+class ListLRUCache {
+    std::list<uint64_t> lru_list;
+    std::unordered_map<uint64_t, std::list<uint64_t>::iterator> lru_map;
+    std::unordered_map<uint64_t, uint64_t> wb_map;
+    size_t capacity;
+
+public:
+    ListLRUCache(size_t cap) : capacity(cap) {}
+
+    void insert(uint64_t key, uint64_t value) {
+        if (lru_map.find(key) != lru_map.end()) {
+            lru_list.erase(lru_map[key]);
+            lru_list.push_front(key);
+            lru_map[key] = lru_list.begin();
+            wb_map[key] = value;
+        } else {
+            if (lru_list.size() == capacity) {
+                uint64_t old_key = lru_list.back();
+                lru_list.pop_back();
+                lru_map.erase(old_key);
+                wb_map.erase(old_key);
+            }
+            lru_list.push_front(key);
+            lru_map[key] = lru_list.begin();
+            wb_map[key] = value;
+        }
+    }
+
+    uint64_t get(uint64_t key) {
+        if (lru_map.find(key) == lru_map.end()) {
+            throw std::runtime_error("Key not found");
+        }
+        lru_list.erase(lru_map[key]);
+        lru_list.push_front(key);
+        lru_map[key] = lru_list.begin();
+        return wb_map[key];
+    }
+};
+
+/** Warm the cache to capacity, then time insert+get pairs over a key space twice the capacity */
+template <typename Cache> static std::tuple<double, double> run_lru(size_t cap, const std::vector<uint64_t> &keys) {
+    Cache cache(cap);
+    for (uint64_t k = 0; k < cap; k++) {
+        cache.insert(k, k);
+    }
+    uint64_t sum = 0;
+    auto allocs = allocations.load();
+    auto rate = samples_per_sec(keys.size(), [&] {
+        for (auto k : keys) {
+            cache.insert(k, k);
+            sum += cache.get(k);
+        }
+    });
+    allocs = allocations.load() - allocs;
+    asm volatile("" : : "r"(sum));
+    return {rate, (double)allocs / keys.size()};
+}
+
+static void bench_lru(const BenchConfig &conf) {
+    std::cout << fmt::format("{:>10} {:>16} {:>10} {:>16} {:>10}\n", "capacity", "list ops/sec", "allocs/op",
+                             "array ops/sec", "allocs/op");
+    for (size_t cap = 1024; cap <= conf.footprint; cap *= 4) {
+        std::vector<uint64_t> keys(std::max<uint64_t>(conf.samples, cap));
+        uint64_t state = 0xdeadbeef1245678;
+        for (auto &k : keys) {
+            k = xorshift(state) % (cap * 2);
+        }
+        auto [list_rate, list_allocs] = run_lru<ListLRUCache>(cap, keys);
+        auto [array_rate, array_allocs] = run_lru<LRUCache>(cap, keys);
+        std::cout << fmt::format("{:>10} {:>16.0f} {:>10.3f} {:>16.0f} {:>10.3f}\n", cap, list_rate, list_allocs,
+                                 array_rate, array_allocs);
+    }
+}
+
+static void bench_occupation(const BenchConfig &conf) {
+    std::vector<uint64_t> addrs(conf.samples);
+    uint64_t state = 0xdeadbeef1245678;
+    for (auto &a : addrs) {
+        a = (xorshift(state) % conf.footprint) * 64;
+    }
+
+    // the legacy scan is quadratic, so only time a prefix of the stream
+    auto legacy_samples = std::min<uint64_t>(conf.samples, 100000);
+    std::map<uint64_t, uint64_t> legacy;
+    auto legacy_rate = samples_per_sec(legacy_samples, [&] {
+        for (uint64_t i = 0; i < legacy_samples; i++) {
+            legacy_insert(legacy, i, addrs[i]);
+        }
+    });
+
+    CXLMemExpander expander(50, 50, 100, 150, 0, 20);
+    auto rate = samples_per_sec(conf.samples, [&] {
+        for (uint64_t i = 0; i < conf.samples; i++) {
+            expander.insert(i, addrs[i], addrs[i], 0, ACCESS_UNKNOWN);
+        }
+    });
+
+    std::cout << fmt::format("occupation samples={} footprint={} entries={}\n", conf.samples, conf.footprint,
+                             expander.occupation.size());
+    std::cout << fmt::format("  legacy map scan : {:.0f} samples/sec (first {} samples)\n", legacy_rate,
+                             legacy_samples);
+    std::cout << fmt::format("  dual index      : {:.0f} samples/sec ({:.1f}x)\n", rate, rate / legacy_rate);
+}
+
+/** write the stream as a raw and a packed trace and read both back, the size against the 48 byte perf_sample */
+static void bench_trace(const BenchConfig &conf) {
+    // mostly strided lines with random jumps, a handful of threads, two loads to a store, the pages scattered
+    std::vector<SampleBatch> epochs((conf.samples + 65535) / 65536);
+    uint64_t state = 0xdeadbeef1245678, timestamp = 0, line = 0;
+    for (uint64_t i = 0; i < conf.samples; i++) {
+        auto r = xorshift(state);
+        line = r % 4 == 0 ? r % conf.footprint : (line + 1) % conf.footprint;
+        auto virt_addr = 0x7f0000000000 + line * 64 + (r >> 58);
+        auto phys_addr = ((virt_addr >> 12) * 0x9e3779b97f4a7c15 >> 36) << 12 | (virt_addr & 4095);
+        timestamp += 500 + (r >> 20) % 2000;
+        epochs[i / 65536].push_back(timestamp, virt_addr, phys_addr, 1000 + (r >> 40) % 4,
+                                    (r >> 50) % 3 == 0 ? ACCESS_STORE : ACCESS_LOAD);
+    }
+    std::cout << fmt::format("trace samples={} footprint={}\n", conf.samples, conf.footprint);
+    std::cout << fmt::format("{:>8} {:>14} {:>10} {:>8} {:>16} {:>16}\n", "format", "bytes", "B/sample", "ratio",
+                             "write samples/s", "read samples/s");
+    for (auto packed : {false, true}) {
+        auto path = fmt::format("/tmp/cxlmemsim_bench_{}.trace", getpid());
+        uint64_t bytes = 0;
+        auto write_rate = samples_per_sec(conf.samples, [&] {
+            TraceWriter writer(path, 0, 1000, 1, false, packed);
+            for (auto const &[e, batch] : epochs | enumerate) {
+                writer.samples(e, 0, batch);
+            }
+            writer.close();
+            bytes = writer.bytes;
+        });
+        TraceReader reader(path);
+        SampleBatch batch;
+        uint64_t check = 0;
+        auto read_rate = samples_per_sec(conf.samples, [&] {
+            auto offset = reader.begin();
+            while (auto *record = reader.next(offset)) {
+                if (record->kind == TRACE_SAMPLES || record->kind == TRACE_BLOCK) {
+                    reader.samples(record, batch);
+                    check += batch.size();
+                }
+            }
+        });
+        unlink(path.c_str());
+        if (check != conf.samples) {
+            LOG(ERROR) << fmt::format("read back {} of {} samples\n", check, conf.samples);
+        }
+        std::cout << fmt::format("{:>8} {:>14} {:>10.2f} {:>7.2f}x {:>16.0f} {:>16.0f}\n", packed ? "packed" : "raw",
+                                 bytes, (double)bytes / (double)conf.samples,
+                                 48. * (double)conf.samples / (double)bytes, write_rate, read_rate);
+    }
+}
+
+/** time one epoch's latency plus bandwidth pass over n packed expanders, return ns per pass and the delay */
+static std::tuple<double, double> run_kernel(const DelayKernel &kernel, size_t n, uint64_t passes,
+                                             std::vector<std::vector<double>> &a) {
+    double delay = 0;
+    auto rate = samples_per_sec(passes, [&] {
+        for (uint64_t p = 0; p < passes; p++) {
+            delay = kernel.latency(n, a[0].data(), a[1].data(), a[2].data(), a[3].data(), .3, .1, 110, a[6].data());
+            delay +=
+                kernel.bandwidth(n, a[0].data(), a[1].data(), a[6].data(), a[4].data(), a[5].data(), 900, 400, 1000);
+        }
+    });
+    return std::make_tuple(1e9 / rate, delay);
+}
+
+static void bench_kernel(const BenchConfig &conf) {
+    uint64_t state = 0xdeadbeef1245678;
+    auto avx512 = __builtin_cpu_supports("avx512f");
+    std::cout << fmt::format("kernel passes={} runtime pick={}\n", conf.samples, delay_kernel().name);
+    std::cout << fmt::format("{:>10} {:>14} {:>14} {:>10} {:>12}\n", "expanders", "scalar ns", "avx512 ns", "speedup",
+                             "rel diff");
+    for (size_t n = 8; n <= 256; n *= 2) {
+        // read, write, read latency, write latency, inverse read and write bandwidth, latency out
+        std::vector<std::vector<double>> a(7, std::vector<double>(n));
+        for (size_t i = 0; i < n; i++) {
+            a[0][i] = (double)(xorshift(state) % 100000);
+            a[1][i] = (double)(xorshift(state) % 100000);
+            a[2][i] = 100 + (double)(xorshift(state) % 200);
+            a[3][i] = 150 + (double)(xorshift(state) % 200);
+            a[4][i] = 1. / (20 + (double)(xorshift(state) % 60));
+            a[5][i] = 1. / (20 + (double)(xorshift(state) % 60));
+        }
+        auto [scalar_ns, scalar_delay] = run_kernel(scalar_kernel, n, conf.samples, a);
+        if (!avx512) {
+            std::cout << fmt::format("{:>10} {:>14.1f} {:>14} {:>10} {:>12}\n", n, scalar_ns, "-", "-", "-");
+            continue;
+        }
+        auto [avx512_ns, avx512_delay] = run_kernel(avx512_kernel, n, conf.samples, a);
+        std::cout << fmt::format("{:>10} {:>14.1f} {:>14.1f} {:>9.2f}x {:>12.2e}\n", n, scalar_ns, avx512_ns,
+                                 scalar_ns / avx512_ns, std::abs(avx512_delay - scalar_delay) / scalar_delay);
+    }
+}
+
+int main(int argc, char *argv[]) {
+    cxxopts::Options options("CXLMemSimBench", "Micro benchmarks for the CXLMemSim model core");
+    options.add_options()("b,bench", "The benchmark to run: occupation, lru, kernel, trace",
+                          cxxopts::value<std::string>()->default_value("occupation"))(
+        "h,help", "Help for CXLMemSimBench", cxxopts::value<bool>()->default_value("false"))(
+        "n,samples", "The number of samples to feed, or kernel passes",
+        cxxopts::value<uint64_t>()->default_value("200000"))(
+        "f,footprint", "The number of distinct cachelines touched, or the largest lru capacity",
+        cxxopts::value<uint64_t>()->default_value("16384"));
+
+    auto result = options.parse(argc, argv);
+    if (result["help"].as<bool>()) {
+        std::cout << options.help() << std::endl;
+        exit(0);
+    }
+    auto bench = result["bench"].as<std::string>();
+    BenchConfig conf = {
+        .samples = result["samples"].as<uint64_t>(),
+        .footprint = result["footprint"].as<uint64_t>(),
+    };
+
+    if (bench == "occupation") {
+        bench_occupation(conf);
+    } else if (bench == "lru") {
+        bench_lru(conf);
+    } else if (bench == "kernel") {
+        bench_kernel(conf);
+    } else if (bench == "trace") {
+        bench_trace(conf);
+    } else {
+        LOG(ERROR) << fmt::format("Unknown benchmark {}\n", bench);
+        return 1;
+    }
+    return 0;
+}
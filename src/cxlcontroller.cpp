@@ -3,8 +3,79 @@
 //
 
 #include "cxlcontroller.h"
+#include "logging.h"
+#include <charconv>
+#include <cxxopts.hpp>
+#include <memory>
 
-void CXLController::insert_end_point(CXLMemExpander *end_point) { this->cur_expanders.emplace_back(end_point); }
+void add_model_options(cxxopts::Options &options) {
+    options.add_options()("d,dramlatency", "The current platform's dram latency",
+                          cxxopts::value<double>()->default_value("110"))(
+        "m,mode", "Page mode or cacheline mode", cxxopts::value<std::string>()->default_value("p"))(
+        "o,topology", "The newick tree input for the CXL memory expander topology",
+        cxxopts::value<std::string>()->default_value("(1,(2,3))"))(
+        "e,capacity", "The capacity vector of the CXL memory expander with the first local",
+        cxxopts::value<std::vector<int>>()->default_value("0,20,20,20"))(
+        "l,latency", "The simulated latency by epoch based calculation for injected latency",
+        cxxopts::value<std::vector<int>>()->default_value("100,150,100,150,100,150"))(
+        "b,bandwidth", "The simulated bandwidth by linear regression",
+        cxxopts::value<std::vector<int>>()->default_value("50,50,50,50,50,50"))(
+        "window", "Keep occupation only for the last N epochs, 0 keeps everything",
+        cxxopts::value<int>()->default_value("0"))(
+        "budget", "The occupation entry budget per expander, 0 for unbounded",
+        cxxopts::value<uint64_t>()->default_value("0"))(
+        "port_bandwidth",
+        "The upstream port read,write bandwidth of each switch by id with the root first, 0 for unlimited",
+        cxxopts::value<std::vector<int>>()->default_value("0,0"));
+}
+
+ControllerConfig ControllerConfig::from(const cxxopts::ParseResult &result) {
+    return {
+        .capacity = result["capacity"].as<std::vector<int>>(),
+        .latency = result["latency"].as<std::vector<int>>(),
+        .bandwidth = result["bandwidth"].as<std::vector<int>>(),
+        .topology = result["topology"].as<std::string>(),
+        .mode = page_type_of(result["mode"].as<std::string>()),
+        .interval = result["interval"].as<int>(),
+        .window = result["window"].as<int>(),
+        .budget = result["budget"].as<uint64_t>(),
+        .port_bandwidth = result["port_bandwidth"].as<std::vector<int>>(),
+    };
+}
+
+CXLController *ControllerConfig::build(AllocationPolicy *policy) const {
+    if (capacity.empty()) {
+        throw std::invalid_argument("No local memory capacity");
+    }
+    if (latency.size() < (capacity.size() - 1) * 2 || bandwidth.size() < (capacity.size() - 1) * 2) {
+        throw std::invalid_argument(fmt::format("{} expanders need {} latency and bandwidth values, got {} and {}",
+                                                capacity.size() - 1, (capacity.size() - 1) * 2, latency.size(),
+                                                bandwidth.size()));
+    }
+    LOG(DEBUG) << fmt::format("local_memory_region capacity:{}\n", capacity[0]);
+    // owned here until the topology is in, the switches built so far go with it
+    std::unique_ptr<CXLController> controller(new CXLController(policy, capacity[0], mode, interval));
+    for (size_t idx = 1; idx < capacity.size(); idx++) {
+        LOG(DEBUG) << fmt::format("memory_region:{}\n", idx);
+        LOG(DEBUG) << fmt::format(" capacity:{}\n", capacity[idx]);
+        LOG(DEBUG) << fmt::format(" read_latency:{}\n", latency[(idx - 1) * 2]);
+        LOG(DEBUG) << fmt::format(" write_latency:{}\n", latency[(idx - 1) * 2 + 1]);
+        LOG(DEBUG) << fmt::format(" read_bandwidth:{}\n", bandwidth[(idx - 1) * 2]);
+        LOG(DEBUG) << fmt::format(" write_bandwidth:{}\n", bandwidth[(idx - 1) * 2 + 1]);
+        auto *ep = new CXLMemExpander(bandwidth[(idx - 1) * 2], bandwidth[(idx - 1) * 2 + 1], latency[(idx - 1) * 2],
+                                      latency[(idx - 1) * 2 + 1], (int)(idx - 1), capacity[idx]);
+        controller->insert_end_point(ep);
+    }
+    controller->construct_topo(topology);
+    controller->set_window(window, budget);
+    controller->set_port_bandwidth(port_bandwidth);
+    return controller.release();
+}
+
+void CXLController::insert_end_point(CXLMemExpander *end_point) {
+    end_point->occupation.set_granularity(page_type_size(this->page_type_));
+    this->cur_expanders.emplace_back(end_point);
+}
 
 void CXLController::construct_topo(std::string_view newick_tree) {
     auto tokens = tokenize(newick_tree);
@@ -15,6 +86,9 @@ void CXLController::construct_topo(std::string_view newick_tree) {
             num_switches++;
         } else if (token == "(") {
             /** if is not on the top level */
+            if (stk.empty()) {
+                throw std::invalid_argument("Unbalanced number of parentheses");
+            }
             auto cur = new CXLSwitch(num_switches++);
             stk.back()->switches.push_back(cur);
             stk.push_back(cur);
@@ -27,28 +101,60 @@ void CXLController::construct_topo(std::string_view newick_tree) {
         } else if (token == ",") {
             continue;
         } else {
-            stk.back()->expanders.emplace_back(this->cur_expanders[atoi(token.c_str()) - 1]);
+            size_t index = 0;
+            auto [end, ec] = std::from_chars(token.data(), token.data() + token.size(), index);
+            if (ec != std::errc() || end != token.data() + token.size() || index == 0 ||
+                index > this->cur_expanders.size()) {
+                throw std::invalid_argument(fmt::format("No expander {} in {}", token, newick_tree));
+            }
+            if (stk.empty()) {
+                throw std::invalid_argument("Unbalanced number of parentheses");
+            }
+            stk.back()->expanders.emplace_back(this->cur_expanders[index - 1]);
         }
     }
+    this->topology.compile(this, this->epoch);
 }
 
 CXLController::CXLController(AllocationPolicy *p, int capacity, enum page_type page_type_, int epoch)
     : CXLSwitch(0), capacity(capacity), policy(p), page_type_(static_cast<page_type>(page_type_)) {
-    for (auto switch_ : this->switches) {
-        switch_->set_epoch(epoch);
-    }
-    for (auto expander : this->expanders) {
-        expander->set_epoch(epoch);
-    }
+    this->epoch = epoch;
+    this->occupation.set_granularity(page_type_size(page_type_));
+    // the epoch reaches switches and expanders when construct_topo compiles the topology
     // TODO get LRU wb
     // TODO BW type series
 
     // deferentiate R/W for multireader multi writer
 }
 
-double CXLController::calculate_latency(LatencyPass elem) { return CXLSwitch::calculate_latency(elem) * 1000; }
+double CXLController::calculate_latency(LatencyPass elem) { return this->topology.calculate_latency(elem) * 1000; }
+
+double CXLController::calculate_bandwidth(BandwidthPass elem) {
+    return this->topology.calculate_bandwidth(elem) * 1000;
+}
+
+void CXLController::set_port_bandwidth(const std::vector<int> &bandwidth) {
+    for (auto const &[s, switch_] : this->topology.switch_node | enumerate) {
+        auto id = (size_t)switch_->id;
+        if (id * 2 + 1 >= bandwidth.size()) {
+            continue;
+        }
+        switch_->port_read_bandwidth = bandwidth[id * 2];
+        switch_->port_write_bandwidth = bandwidth[id * 2 + 1];
+        this->topology.port_read_bandwidth[s] = bandwidth[id * 2];
+        this->topology.port_write_bandwidth[s] = bandwidth[id * 2 + 1];
+    }
+}
+
+CXLController::~CXLController() {
+    for (auto expander : this->cur_expanders) {
+        delete expander;
+    }
+}
 
-double CXLController::calculate_bandwidth(BandwidthPass elem) { return CXLSwitch::calculate_bandwidth(elem) * 1000; }
+double CXLController::calculate_queueing(LatencyPass lat, BandwidthPass bw) {
+    return this->topology.calculate_queueing(lat, bw);
+}
 
 std::string CXLController::output() {
     std::string res;
@@ -73,30 +179,123 @@ std::string CXLController::output() {
     return res;
 }
 
-void CXLController::delete_entry(uint64_t addr, uint64_t length) { CXLSwitch::delete_entry(addr, length); }
+void CXLController::delete_entry(uint64_t addr, uint64_t length) {
+    auto end = addr + length;
+    auto [first, last] = occupation.covered(va_pa_map, addr, end);
+    for (auto it = first; it != last; ++it) {
+        if (occupation.erase(it->second)) {
+            dropped.push_back(it->second);
+        }
+    }
+    va_pa_map.erase(first, last);
+    occupation.erase_range(addr, end, [this](const OccupationEntry &e) { dropped.push_back(e.address); });
+    CXLSwitch::delete_entry(addr, length);
+    prune_placement();
+}
+
+int CXLController::insert(uint64_t timestamp, uint64_t phys_addr, uint64_t virt_addr, int index, int type) {
+    // keep every unit where it was first placed
+    auto unit = this->occupation.unit(phys_addr != 0 ? phys_addr : virt_addr);
+    auto [placed, inserted] = this->placement.try_emplace(unit, -1);
+    if (inserted) {
+        placed->second = policy->compute_once(this);
+    }
+    return insert_placed(timestamp, phys_addr, virt_addr, placed->second, type);
+}
+
+size_t CXLController::insert_batch(const SampleBatch &batch) {
+    auto n = batch.size();
+    batch_target.resize(n);
+    // the lookups are independent of each other, so their misses overlap; units new to the controller are left for
+    // the ordered pass, where the policy sees the same state as it would sample by sample
+    for (size_t i = 0; i < n; i++) {
+        auto unit = this->occupation.unit(batch.phys_addr[i] != 0 ? batch.phys_addr[i] : batch.virt_addr[i]);
+        auto placed = this->placement.find(unit);
+        batch_target[i] = placed != this->placement.end() ? placed->second : unplaced;
+    }
+    size_t taken = 0;
+    for (size_t i = 0; i < n; i++) {
+        this->topology.weight = batch.type[i] == ACCESS_STORE ? batch.store_weight : batch.weight;
+        auto ret = batch_target[i] == unplaced
+                       ? insert(batch.timestamp[i], batch.phys_addr[i], batch.virt_addr[i], 0, batch.type[i])
+                       : insert_placed(batch.timestamp[i], batch.phys_addr[i], batch.virt_addr[i], batch_target[i],
+                                       batch.type[i]);
+        taken += ret != 0;
+    }
+    this->topology.weight = 1;
+    return taken;
+}
 
-int CXLController::insert(uint64_t timestamp, uint64_t phys_addr, uint64_t virt_addr, int index) {
-    auto index_ = policy->compute_once(this);
+int CXLController::insert_placed(uint64_t timestamp, uint64_t phys_addr, uint64_t virt_addr, int index_, int type) {
+    this->last_timestamp = std::max(this->last_timestamp, timestamp);
     if (index_ == -1) {
-        this->occupation.emplace(timestamp, phys_addr);
-        this->va_pa_map.emplace(virt_addr, phys_addr);
+        auto [entry, touched] = this->occupation.insert(timestamp, phys_addr, virt_addr);
+        if (type == ACCESS_UNKNOWN) {
+            type = touched ? ACCESS_LOAD : ACCESS_STORE;
+        }
+        if (type == ACCESS_LOAD) {
+            entry->reads++;
+        } else {
+            entry->writes++;
+        }
+        if (!touched && window_budget != 0) {
+            age_out_local(0);
+        }
+        this->va_pa_map.emplace(this->occupation.unit(virt_addr), this->occupation.unit(phys_addr));
         this->counter.inc_local();
         return true;
     } else {
         this->counter.inc_remote();
-        for (auto switch_ : this->switches) {
-            auto res = switch_->insert(timestamp, phys_addr, virt_addr, index_);
-            if (res != 0) {
-                return res;
-            };
+        return this->topology.insert(timestamp, phys_addr, virt_addr, index_, type);
+    }
+}
+
+void CXLController::set_window(int epochs, size_t budget) {
+    this->window_epochs = epochs;
+    this->window_budget = budget;
+    for (auto expander : this->cur_expanders) {
+        expander->occupation_budget = budget;
+    }
+}
+
+size_t CXLController::age_out_local(uint64_t cutoff) {
+    return occupation.age_out(cutoff, window_budget, [this](const OccupationEntry &e) {
+        auto it = va_pa_map.find(e.virt_addr);
+        if (it != va_pa_map.end() && it->second == e.address) {
+            va_pa_map.erase(it);
         }
-        for (auto expander_ : this->expanders) {
-            auto res = expander_->insert(timestamp, phys_addr, virt_addr, index_);
-            if (res != 0) {
-                return res;
-            };
+        dropped.push_back(e.address);
+    });
+}
+
+size_t CXLController::age_out() {
+    uint64_t cutoff = 0;
+    uint64_t span = (uint64_t)window_epochs * this->epoch * 1000000; // epoch in ms, sample timestamps in ns
+    if (window_epochs != 0 && this->last_timestamp > span) {
+        cutoff = this->last_timestamp - span;
+    }
+    auto aged = age_out_local(cutoff);
+    for (auto expander : this->cur_expanders) {
+        aged += expander->age_out(cutoff);
+    }
+    prune_placement();
+    return aged;
+}
+
+void CXLController::prune_placement() {
+    // forget the placement of a dropped unit unless it has come back to where it was placed since
+    auto forget = [this](std::vector<uint64_t> &units, int index, const Occupation &occupation_) {
+        for (auto unit : units) {
+            auto placed = placement.find(unit);
+            if (placed != placement.end() && placed->second == index && !occupation_.contains(unit)) {
+                placement.erase(placed);
+            }
         }
-        return false;
+        units.clear();
+    };
+    forget(dropped, -1, occupation);
+    for (auto const &[i, expander] : cur_expanders | enumerate) {
+        forget(expander->dropped, (int)i, expander->occupation);
     }
 }
 
@@ -118,9 +317,9 @@ std::vector<std::string> CXLController::tokenize(const std::string_view &s) {
     }
     return res;
 }
-std::tuple<int, int> CXLController::get_all_access() { return CXLSwitch::get_all_access(); }
-std::tuple<double, std::vector<uint64_t>> CXLController::calculate_congestion() {
-    return CXLSwitch::calculate_congestion();
+std::tuple<int, int> CXLController::get_all_access() { return this->topology.get_all_access(); }
+std::tuple<double, uint64_t> CXLController::calculate_congestion() {
+    return this->topology.calculate_congestion();
 }
 void CXLController::set_epoch(int epoch) { CXLSwitch::set_epoch(epoch); }
 // TODO: impl me
@@ -79,74 +79,73 @@ double CXLMemExpander::calculate_bandwidth(BandwidthPass bw) {
     return res;
 }
 void CXLMemExpander::delete_entry(uint64_t addr, uint64_t length) {
-    for (auto it1 = va_pa_map.begin(); it1 != va_pa_map.end();) {
-        if (it1->second >= addr && it1->second <= addr + length) {
-            for (auto it = occupation.begin(); it != occupation.end();) {
-                if (it->second == addr) {
-                    it = occupation.erase(it);
-                } else {
-                    it++;
-                }
-            }
-            it1 = va_pa_map.erase(it1);
-            this->counter.inc_load();
+    auto end = addr + length;
+    auto [first, last] = occupation.covered(va_pa_map, addr, end);
+    // freeing only drops the records, it is no access to charge
+    for (auto it = first; it != last; ++it) {
+        if (occupation.erase(it->second)) {
+            dropped.push_back(it->second);
         }
     }
+    va_pa_map.erase(first, last);
     // kernel mode access
-    for (auto it = occupation.begin(); it != occupation.end();) {
-        if (it->second >= addr && it->second <= addr + length) {
-            if (it->second == addr) {
-                it = occupation.erase(it);
-            } else {
-                it++;
-            }
+    occupation.erase_range(addr, end, [this](const OccupationEntry &e) { dropped.push_back(e.address); });
+}
+
+size_t CXLMemExpander::age_out(uint64_t cutoff) {
+    return occupation.age_out(cutoff, occupation_budget, [this](const OccupationEntry &e) {
+        auto it = va_pa_map.find(e.virt_addr);
+        if (it != va_pa_map.end() && it->second == e.address) {
+            va_pa_map.erase(it);
         }
-        this->counter.inc_load();
-    }
+        dropped.push_back(e.address);
+    });
 }
 
-int CXLMemExpander::insert(uint64_t timestamp, uint64_t phys_addr, uint64_t virt_addr, int index) {
+int CXLMemExpander::insert(uint64_t timestamp, uint64_t phys_addr, uint64_t virt_addr, int index, int type) {
 
     if (index == this->id) {
         last_timestamp = last_timestamp > timestamp ? last_timestamp : timestamp; // Update the last timestamp
         // Check if the address is already in the map)
+        virt_addr = occupation.unit(virt_addr);
+        phys_addr = occupation.unit(phys_addr);
         if (phys_addr != 0) {
-            if (va_pa_map.find(virt_addr) == va_pa_map.end()) {
-                this->va_pa_map.emplace(virt_addr, phys_addr);
-            } else {
-                this->va_pa_map[virt_addr] = phys_addr;
+            auto [it, inserted] = this->va_pa_map.try_emplace(virt_addr, phys_addr);
+            if (!inserted && it->second != phys_addr) {
+                it->second = phys_addr;
                 LOG(INFO) << fmt::format("virt:{} phys:{} conflict insertion detected\n", virt_addr, phys_addr);
             }
-            for (auto it = this->occupation.cbegin(); it != this->occupation.cend(); it++) {
-                if ((*it).second == phys_addr) {
-                    this->occupation.erase(it);
-                    this->occupation.emplace(timestamp, phys_addr);
-                    this->counter.inc_load();
-                    return 2;
-                }
-            }
-            this->occupation.emplace(timestamp, phys_addr);
-            this->counter.inc_store();
-            return 1;
+            extend_span(virt_addr);
         } else { // kernel mode access
-            for (auto it = this->occupation.cbegin(); it != this->occupation.cend(); it++) {
-                if ((*it).second == virt_addr) {
-                    this->occupation.erase(it);
-                    this->occupation.emplace(timestamp, virt_addr);
-                    this->counter.inc_load();
-                    return 2;
-                }
-            }
-
-            this->occupation.emplace(timestamp, virt_addr);
+            phys_addr = virt_addr;
+        }
+        extend_span(phys_addr);
+        auto [entry, touched] = this->occupation.insert(timestamp, phys_addr, virt_addr);
+        if (type == ACCESS_UNKNOWN) {
+            type = touched ? ACCESS_LOAD : ACCESS_STORE;
+        }
+        if (type == ACCESS_LOAD) {
+            entry->reads++;
+            this->counter.inc_load();
+        } else {
+            entry->writes++;
             this->counter.inc_store();
-            return 1;
         }
-
+        if (!touched && occupation_budget != 0) {
+            age_out(0);
+        }
+        return type;
     } else {
         return 0;
     }
 }
+void CXLEndPoint::extend_span(uint64_t addr) {
+    min_addr = std::min(min_addr, addr);
+    max_addr = std::max(max_addr, addr);
+}
+bool CXLEndPoint::overlaps(uint64_t addr, uint64_t length) const {
+    return min_addr <= max_addr && addr <= max_addr && addr + length > min_addr;
+}
 std::string CXLMemExpander::output() { return fmt::format("CXLMemExpander {}", this->id); }
 std::tuple<int, int> CXLMemExpander::get_all_access() {
     this->last_read = this->counter.load - this->last_counter.load;
@@ -178,13 +177,22 @@ std::string CXLSwitch::output() {
 }
 void CXLSwitch::delete_entry(uint64_t addr, uint64_t length) {
     for (auto &expander : this->expanders) {
-        expander->delete_entry(addr, length);
+        if (expander->overlaps(addr, length)) {
+            expander->delete_entry(addr, length);
+        }
     }
     for (auto &switch_ : this->switches) {
-        switch_->delete_entry(addr, length);
+        if (switch_->overlaps(addr, length)) {
+            switch_->delete_entry(addr, length);
+        }
     }
 }
 CXLSwitch::CXLSwitch(int id) : id(id) {}
+CXLSwitch::~CXLSwitch() {
+    for (auto sw : this->switches) {
+        delete sw;
+    }
+}
 double CXLSwitch::calculate_latency(LatencyPass elem) {
     double lat = 0.0;
     for (auto &expander : this->expanders) {
@@ -206,61 +214,44 @@ double CXLSwitch::calculate_bandwidth(BandwidthPass elem) {
     // time series
     return bw;
 }
-int CXLSwitch::insert(uint64_t timestamp, uint64_t phys_addr, uint64_t virt_addr, int index) {
+int CXLSwitch::insert(uint64_t timestamp, uint64_t phys_addr, uint64_t virt_addr, int index, int type) {
+    // the first child that owns the index takes the sample
+    auto ret = 0;
     for (auto &expander : this->expanders) { // differ read and write。
-        auto ret = expander->insert(timestamp, phys_addr, virt_addr, index);
-        if (ret == 1) {
-            this->counter.inc_store();
-            return 1;
-        } else if (ret == 2) {
-            this->counter.inc_load();
-            return 2;
-        } else {
-            return 0;
+        ret = expander->insert(timestamp, phys_addr, virt_addr, index, type);
+        if (ret != 0) {
+            extend_span(expander->min_addr);
+            extend_span(expander->max_addr);
+            break;
         }
     }
-    for (auto &switch_ : this->switches) {
-        auto ret = switch_->insert(timestamp, phys_addr, virt_addr, index);
-        if (ret == 1) {
-            this->counter.inc_store();
-            return 1;
-        } else if (ret == 2) {
-            this->counter.inc_load();
-            return 2;
-        } else {
-            return 0;
+    for (auto it = this->switches.begin(); ret == 0 && it != this->switches.end(); ++it) {
+        ret = (*it)->insert(timestamp, phys_addr, virt_addr, index, type);
+        if (ret != 0) {
+            extend_span((*it)->min_addr);
+            extend_span((*it)->max_addr);
         }
     }
-    return 0;
+    if (ret == 1) {
+        this->counter.inc_store();
+    } else if (ret == 2) {
+        this->counter.inc_load();
+    }
+    if (ret != 0) {
+        record_arrival(timestamp);
+    }
+    return ret;
 }
-std::tuple<double, std::vector<uint64_t>> CXLSwitch::calculate_congestion() {
-    double latency = 0.0;
-    std::vector<uint64_t> congestion;
+std::tuple<double, uint64_t> CXLSwitch::calculate_congestion() {
+    uint64_t conflicts = this->epoch_conflicts;
+    double latency = (double)conflicts * this->congestion_latency;
+    this->epoch_conflicts = 0;
     for (auto &switch_ : this->switches) {
         auto [lat, con] = switch_->calculate_congestion();
         latency += lat;
-        congestion.insert(congestion.end(), con.begin(), con.end());
-    }
-    for (auto &expander : this->expanders) {
-        for (auto &it : expander->occupation) {
-            // every epoch
-            if (it.first > this->last_timestamp - epoch * 1e3) {
-                congestion.push_back(it.first);
-            }
-        }
-    }
-    sort(congestion.begin(), congestion.end());
-    for (auto it = congestion.begin(); it != congestion.end(); ++it) {
-        if (*(it + 1) - *it < 2000) { // if less than 20ns
-            latency += this->congestion_latency;
-            this->counter.inc_conflict();
-            if (it + 1 == congestion.end()) {
-                break;
-            }
-            congestion.erase(it);
-        }
+        conflicts += con;
     }
-    return std::make_tuple(latency, congestion);
+    return std::make_tuple(latency, conflicts);
 }
 std::tuple<int, int> CXLSwitch::get_all_access() {
     int read = 0, write = 0;
@@ -0,0 +1,94 @@
+#include "cxlkernel.h"
+#include <immintrin.h>
+
+static constexpr double bandwidth_scale = 64. / 1024 / 1024 * 1000;
+
+static double latency_scalar(size_t n, const double *read, const double *write, const double *read_latency,
+                             const double *write_latency, double read_coef, double write_coef, double dramlatency,
+                             double *out) {
+    double lat = 0.0;
+    for (size_t i = 0; i < n; i++) {
+        out[i] = read_coef * read[i] * (read_latency[i] - dramlatency) +
+                 write_coef * write[i] * (write_latency[i] - dramlatency);
+        lat += out[i];
+    }
+    return lat;
+}
+
+static double bandwidth_scalar(size_t n, const double *read, const double *write, const double *latency,
+                               const double *inv_read_bandwidth, const double *inv_write_bandwidth, double read_coef,
+                               double write_coef, double epoch) {
+    double res = 0.0;
+    for (size_t i = 0; i < n; i++) {
+        auto scale = bandwidth_scale / (epoch + latency[i]);
+        auto read_over = read[i] * read_coef * scale * inv_read_bandwidth[i];
+        auto write_over = write[i] * write_coef * scale * inv_write_bandwidth[i];
+        if (read_over > 1) {
+            res += read_over - epoch * 0.001;
+        }
+        if (write_over > 1) {
+            res += write_over - epoch * 0.001;
+        }
+    }
+    return res;
+}
+
+/** lanes past n are masked off the loads and stores, so the tail needs no scalar epilogue */
+static inline __mmask8 __attribute__((target("avx512f"))) tail_mask(size_t n, size_t i) {
+    return n - i >= 8 ? (__mmask8)0xff : (__mmask8)((1u << (n - i)) - 1);
+}
+
+__attribute__((target("avx512f"))) static double
+latency_avx512(size_t n, const double *read, const double *write, const double *read_latency,
+               const double *write_latency, double read_coef, double write_coef, double dramlatency, double *out) {
+    auto ro = _mm512_set1_pd(read_coef);
+    auto wb = _mm512_set1_pd(write_coef);
+    auto dram = _mm512_set1_pd(dramlatency);
+    auto sum = _mm512_setzero_pd();
+    for (size_t i = 0; i < n; i += 8) {
+        auto m = tail_mask(n, i);
+        auto r = _mm512_maskz_loadu_pd(m, read + i);
+        auto w = _mm512_maskz_loadu_pd(m, write + i);
+        auto rl = _mm512_maskz_loadu_pd(m, read_latency + i);
+        auto wl = _mm512_maskz_loadu_pd(m, write_latency + i);
+        auto lat = _mm512_add_pd(_mm512_mul_pd(_mm512_mul_pd(ro, r), _mm512_sub_pd(rl, dram)),
+                                 _mm512_mul_pd(_mm512_mul_pd(wb, w), _mm512_sub_pd(wl, dram)));
+        _mm512_mask_storeu_pd(out + i, m, lat);
+        sum = _mm512_mask_add_pd(sum, m, sum, lat);
+    }
+    return _mm512_reduce_add_pd(sum);
+}
+
+__attribute__((target("avx512f"))) static double
+bandwidth_avx512(size_t n, const double *read, const double *write, const double *latency,
+                 const double *inv_read_bandwidth, const double *inv_write_bandwidth, double read_coef,
+                 double write_coef, double epoch) {
+    auto ro = _mm512_set1_pd(read_coef);
+    auto wb = _mm512_set1_pd(write_coef);
+    auto k = _mm512_set1_pd(bandwidth_scale);
+    auto ep = _mm512_set1_pd(epoch);
+    auto base = _mm512_set1_pd(epoch * 0.001);
+    auto one = _mm512_set1_pd(1);
+    auto sum = _mm512_setzero_pd();
+    for (size_t i = 0; i < n; i += 8) {
+        auto m = tail_mask(n, i);
+        auto scale = _mm512_div_pd(k, _mm512_add_pd(ep, _mm512_maskz_loadu_pd(m, latency + i)));
+        auto read_over = _mm512_mul_pd(_mm512_mul_pd(_mm512_mul_pd(_mm512_maskz_loadu_pd(m, read + i), ro), scale),
+                                       _mm512_maskz_loadu_pd(m, inv_read_bandwidth + i));
+        auto write_over = _mm512_mul_pd(_mm512_mul_pd(_mm512_mul_pd(_mm512_maskz_loadu_pd(m, write + i), wb), scale),
+                                        _mm512_maskz_loadu_pd(m, inv_write_bandwidth + i));
+        sum = _mm512_mask_add_pd(sum, _mm512_mask_cmp_pd_mask(m, read_over, one, _CMP_GT_OQ), sum,
+                                 _mm512_sub_pd(read_over, base));
+        sum = _mm512_mask_add_pd(sum, _mm512_mask_cmp_pd_mask(m, write_over, one, _CMP_GT_OQ), sum,
+                                 _mm512_sub_pd(write_over, base));
+    }
+    return _mm512_reduce_add_pd(sum);
+}
+
+const DelayKernel scalar_kernel = {"scalar", latency_scalar, bandwidth_scalar};
+const DelayKernel avx512_kernel = {"avx512", latency_avx512, bandwidth_avx512};
+
+const DelayKernel &delay_kernel() {
+    static const DelayKernel &kernel = __builtin_cpu_supports("avx512f") ? avx512_kernel : scalar_kernel;
+    return kernel;
+}
@@ -0,0 +1,188 @@
+#include "cxltopology.h"
+#include <algorithm>
+#include <cmath>
+
+void CXLTopology::visit(CXLSwitch *node, int parent) {
+    auto idx = (int)switch_node.size();
+    switch_node.push_back(node);
+    switch_parent.push_back(parent);
+    switch_first.push_back(expander_node.size());
+    switch_last.push_back(0);
+    for (auto expander : node->expanders) {
+        expander_node.push_back(expander);
+        expander_parent.push_back(idx);
+    }
+    for (auto switch_ : node->switches) {
+        visit(switch_, idx);
+    }
+    switch_last[idx] = expander_node.size();
+}
+
+void CXLTopology::compile(CXLSwitch *root, int epoch) {
+    *this = CXLTopology();
+    this->epoch = epoch;
+    visit(root, -1);
+    for (auto switch_ : switch_node) {
+        switch_->set_epoch(epoch);
+    }
+    switch_load.assign(num_switches(), 0);
+    switch_store.assign(num_switches(), 0);
+    for (auto switch_ : switch_node) {
+        port_read_bandwidth.push_back(switch_->port_read_bandwidth);
+        port_write_bandwidth.push_back(switch_->port_write_bandwidth);
+    }
+    port_last_load.assign(num_switches(), 0);
+    port_last_store.assign(num_switches(), 0);
+    port_read.assign(num_switches(), 0);
+    port_write.assign(num_switches(), 0);
+    port_read_utilization.assign(num_switches(), 0);
+    port_write_utilization.assign(num_switches(), 0);
+    port_queue_delay.assign(num_switches(), 0);
+    for (auto const &[leaf, expander] : expander_node | enumerate) {
+        if (expander->id >= (int)route.size()) {
+            route.resize(expander->id + 1, -1);
+        }
+        route[expander->id] = leaf;
+        expander->set_epoch(epoch);
+        read_latency.push_back(expander->latency.read);
+        write_latency.push_back(expander->latency.write);
+        inv_read_bandwidth.push_back(1. / expander->bandwidth.read);
+        inv_write_bandwidth.push_back(1. / expander->bandwidth.write);
+    }
+    load.assign(num_expanders(), 0);
+    store.assign(num_expanders(), 0);
+    last_load.assign(num_expanders(), 0);
+    last_store.assign(num_expanders(), 0);
+    last_read.assign(num_expanders(), 0);
+    last_write.assign(num_expanders(), 0);
+    last_latency.assign(num_expanders(), 0);
+}
+
+int CXLTopology::insert(uint64_t timestamp, uint64_t phys_addr, uint64_t virt_addr, int id, int type) {
+    if (id < 0 || id >= (int)route.size() || route[id] < 0) {
+        return 0;
+    }
+    auto leaf = route[id];
+    auto expander = expander_node[leaf];
+    auto ret = expander->insert(timestamp, phys_addr, virt_addr, id, type);
+    if (ret == 0) {
+        return 0;
+    }
+    auto &leaf_counter = ret == 1 ? store[leaf] : load[leaf];
+    leaf_counter += weight;
+    for (auto s = expander_parent[leaf]; s != -1; s = switch_parent[s]) {
+        auto switch_ = switch_node[s];
+        switch_->extend_span(expander->min_addr);
+        switch_->extend_span(expander->max_addr);
+        switch_->last_timestamp = std::max(switch_->last_timestamp, timestamp);
+        switch_->record_arrival(timestamp);
+        if (ret == 1) {
+            switch_->counter.inc_store();
+            switch_store[s] += weight;
+        } else {
+            switch_->counter.inc_load();
+            switch_load[s] += weight;
+        }
+    }
+    return ret;
+}
+
+std::tuple<int, int> CXLTopology::get_all_access() {
+    auto n = num_expanders();
+    double read = 0, write = 0;
+    for (size_t i = 0; i < n; i++) {
+        last_read[i] = load[i] - last_load[i];
+        last_write[i] = store[i] - last_store[i];
+        read += last_read[i];
+        write += last_write[i];
+        last_load[i] = load[i];
+        last_store[i] = store[i];
+    }
+    for (size_t s = 0; s < num_switches(); s++) {
+        port_read[s] = switch_load[s] - port_last_load[s];
+        port_write[s] = switch_store[s] - port_last_store[s];
+        port_last_load[s] = switch_load[s];
+        port_last_store[s] = switch_store[s];
+    }
+    return std::make_tuple((int)std::lround(read), (int)std::lround(write));
+}
+
+double CXLTopology::calculate_latency(const LatencyPass &elem) {
+    auto all_read = (double)std::get<0>(elem.all_access);
+    auto all_write = (double)std::get<1>(elem.all_access);
+    auto read_coef = all_read != 0 ? (double)elem.readonly / all_read : 0.;
+    auto write_coef = all_write != 0 ? (double)elem.writeback / all_write : 0.;
+    return kernel->latency(num_expanders(), last_read.data(), last_write.data(), read_latency.data(),
+                           write_latency.data(), read_coef, write_coef, elem.dramlatency, last_latency.data());
+}
+
+double CXLTopology::calculate_bandwidth(const BandwidthPass &elem) {
+    auto all_read = (double)std::get<0>(elem.all_access);
+    auto all_write = (double)std::get<1>(elem.all_access);
+    auto read_coef = all_read != 0 ? (double)elem.read_config / all_read : 0.;
+    auto write_coef = all_write != 0 ? (double)elem.write_config / all_write : 0.;
+    return kernel->bandwidth(num_expanders(), last_read.data(), last_write.data(), last_latency.data(),
+                             inv_read_bandwidth.data(), inv_write_bandwidth.data(), read_coef, write_coef, epoch);
+}
+
+/** delay in ns of `misses` 64B requests through a port of the given bandwidth at utilization rho: the mean M/D/1 wait
+ * of each, with the queue held at rho_max past saturation, plus the time the epoch stretches to drain what the port
+ * could not carry */
+static double port_delay(double misses, double bandwidth, double rho, double epoch) {
+    constexpr double rho_max = 0.99;
+    auto service = 64. / 1024 / 1024 / bandwidth * 1e9;
+    auto q = std::min(rho, rho_max);
+    auto delay = misses * service * q / (2 * (1 - q));
+    if (rho > 1) {
+        delay += (rho - 1) * epoch * 1e6;
+    }
+    return delay;
+}
+
+double CXLTopology::calculate_queueing(const LatencyPass &lat, const BandwidthPass &bw) {
+    auto all_read = (double)std::get<0>(lat.all_access);
+    auto all_write = (double)std::get<1>(lat.all_access);
+    auto inv_read = all_read != 0 ? 1 / all_read : 0.;
+    auto inv_write = all_write != 0 ? 1 / all_write : 0.;
+    auto scale = 64. / 1024 / 1024 / epoch * 1000;
+    double delay = 0.0;
+    for (size_t s = 0; s < num_switches(); s++) {
+        port_queue_delay[s] = 0;
+        if (port_read_bandwidth[s] > 0) {
+            auto share = port_read[s] * inv_read;
+            port_read_utilization[s] = share * bw.read_config * scale / port_read_bandwidth[s];
+            port_queue_delay[s] +=
+                port_delay((double)lat.readonly * share, port_read_bandwidth[s], port_read_utilization[s], epoch);
+        }
+        if (port_write_bandwidth[s] > 0) {
+            auto share = port_write[s] * inv_write;
+            port_write_utilization[s] = share * bw.write_config * scale / port_write_bandwidth[s];
+            port_queue_delay[s] +=
+                port_delay((double)lat.writeback * share, port_write_bandwidth[s], port_write_utilization[s], epoch);
+        }
+        delay += port_queue_delay[s];
+    }
+    return delay;
+}
+
+std::string CXLTopology::port_output() const {
+    std::string res;
+    for (size_t s = 0; s < num_switches(); s++) {
+        if (port_read_bandwidth[s] > 0 || port_write_bandwidth[s] > 0) {
+            res += fmt::format("port {}: read {:.3f} write {:.3f} queue {:.0f}ns\n", switch_node[s]->id,
+                               port_read_utilization[s], port_write_utilization[s], port_queue_delay[s]);
+        }
+    }
+    return res;
+}
+
+std::tuple<double, uint64_t> CXLTopology::calculate_congestion() {
+    double latency = 0.0;
+    uint64_t conflicts = 0;
+    for (auto switch_ : switch_node) {
+        latency += (double)switch_->epoch_conflicts * switch_->congestion_latency;
+        conflicts += switch_->epoch_conflicts;
+        switch_->epoch_conflicts = 0;
+    }
+    return std::make_tuple(latency, conflicts);
+}
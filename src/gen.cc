@@ -0,0 +1,81 @@
+/** Drive the model with a synthetic sample stream, no PMU or target process needed */
+#include "generator.h"
+#include "helper.h"
+#include "policy.h"
+#include "replay.h"
+#include <chrono>
+#include <cxxopts.hpp>
+#include <memory>
+
+Helper helper{};
+int main(int argc, char *argv[]) {
+    cxxopts::Options options("CXLMemSimGen", "Feed synthetic access streams through the CXLMemSim model");
+    options.add_options()("g,generate", "The phases to play, e.g. \"ld;zipf,n=1M,f=256M,t=0.9,w=0.3;ptr-chasing\"",
+                          cxxopts::value<std::string>()->default_value("ld"))(
+        "h,help", "Help for CXLMemSimGen", cxxopts::value<bool>()->default_value("false"))(
+        "r,rate", "The samples per second of the stream", cxxopts::value<uint64_t>()->default_value("1000000"))(
+        "seed", "The seed of the stream", cxxopts::value<uint64_t>()->default_value("0xdeadbeef1245678"))(
+        "i,interval", "The value for epoch value", cxxopts::value<int>()->default_value("1000"))(
+        "record", "Also write the stream as a trace for CXLMemSimReplay",
+        cxxopts::value<std::string>()->default_value(""))(
+        "record_packed", "Write the trace samples delta and varint packed",
+        cxxopts::value<bool>()->default_value("false"))(
+        "q,quiet", "Only print the overall result", cxxopts::value<bool>()->default_value("false"));
+    add_model_options(options);
+
+    auto result = options.parse(argc, argv);
+    if (result["help"].as<bool>()) {
+        std::cout << options.help() << std::endl;
+        exit(0);
+    }
+    auto phases = Generator::parse(result["generate"].as<std::string>());
+    if (!phases) {
+        return 1;
+    }
+    auto rate = result["rate"].as<uint64_t>();
+    auto dramlatency = result["dramlatency"].as<double>();
+    auto config = ControllerConfig::from(result);
+    auto *policy = new InterleavePolicy();
+    auto *controller = config.build(policy);
+    LOG(INFO) << controller->output() << "\n";
+    std::unique_ptr<TraceWriter> trace;
+    if (!result["record"].as<std::string>().empty()) {
+        trace = std::make_unique<TraceWriter>(result["record"].as<std::string>(), 0, config.interval, 1, false,
+                                              result["record_packed"].as<bool>());
+    }
+
+    /* one epoch of the stream at a time, charged and aged out as the live loop does */
+    Generator generator(*phases, rate, result["seed"].as<uint64_t>());
+    auto per_epoch = std::max<uint64_t>(rate * config.interval / 1000, 1);
+    auto quiet = result["quiet"].as<bool>();
+    SampleBatch batch;
+    uint64_t epoch = 0, samples = 0, delay = 0, model_ns = 0;
+    if (!quiet) {
+        std::cout << fmt::format("{:>10} {:>12} {:>10} {:>16}\n", "epoch", "samples", "stores", "delay ns");
+    }
+    while (generator.next(batch, per_epoch)) {
+        auto start = std::chrono::steady_clock::now();
+        controller->insert_batch(batch);
+        auto epoch_delay_ns = epoch_delay(controller, dramlatency);
+        controller->age_out();
+        model_ns += std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start)
+                        .count();
+        if (trace) {
+            trace->samples(epoch, 0, batch);
+            trace->epoch(epoch, {}, {});
+        }
+        samples += batch.size();
+        delay += epoch_delay_ns;
+        if (!quiet) {
+            std::cout << fmt::format("{:>10} {:>12} {:>10} {:>16}\n", epoch, batch.size(),
+                                     std::ranges::count(batch.type, ACCESS_STORE), epoch_delay_ns);
+        }
+        epoch++;
+    }
+    if (trace) {
+        trace->close();
+    }
+    std::cout << fmt::format("generated {} epochs, {} samples: delay {}ns, model {:.0f} samples/sec\n", epoch,
+                             samples, delay, (double)samples * 1e9 / (double)(model_ns + 1));
+    return 0;
+}
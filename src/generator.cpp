@@ -0,0 +1,196 @@
+#include "generator.h"
+#include "helper.h"
+#include "logging.h"
+#include <cmath>
+#include <sstream>
+#include <utility>
+
+/** sum of 1 / i^theta for i in 1..n, the tail past 2^20 items by its integral */
+static double zeta(uint64_t n, double theta) {
+    constexpr uint64_t exact = 1 << 20;
+    double sum = 0;
+    for (uint64_t i = 1; i <= std::min(n, exact); i++) {
+        sum += 1 / std::pow((double)i, theta);
+    }
+    if (n > exact) {
+        sum += (std::pow(n + 0.5, 1 - theta) - std::pow(exact + 0.5, 1 - theta)) / (1 - theta);
+    }
+    return sum;
+}
+
+// xorshift only needs a state other than 0, every other seed is its own stream
+Generator::Generator(std::vector<GeneratorPhase> phases, uint64_t rate, uint64_t seed)
+    : phases(std::move(phases)), period(1e9 / (double)std::max<uint64_t>(rate, 1)),
+      state(seed != 0 ? seed : 0x9e3779b97f4a7c15) {
+    if (!this->phases.empty()) {
+        start_phase();
+    }
+}
+uint64_t Generator::random() {
+    state ^= state << 13;
+    state ^= state >> 7;
+    state ^= state << 17;
+    return state;
+}
+void Generator::start_phase() {
+    auto const &p = this->phases[this->phase];
+    this->items = std::max<uint64_t>(p.footprint / p.stride, 1);
+    this->done = 0;
+    this->cursor = 0;
+    if (p.pattern == GEN_CHASE) {
+        // Sattolo's shuffle makes the hops one cycle through every item, like init_chasing_index
+        this->chain.resize(this->items);
+        for (uint64_t i = 0; i < this->items; i++) {
+            this->chain[i] = (uint32_t)i;
+        }
+        for (uint64_t i = this->items - 1; i > 0; i--) {
+            std::swap(this->chain[i], this->chain[random() % i]);
+        }
+    } else {
+        this->chain.clear();
+        this->chain.shrink_to_fit();
+    }
+    if (p.pattern == GEN_ZIPF) {
+        // Gray et al., Quickly generating billion-record synthetic databases, as YCSB does
+        this->zeta_n = zeta(this->items, p.theta);
+        this->alpha = 1 / (1 - p.theta);
+        this->eta = (1 - std::pow(2. / (double)this->items, 1 - p.theta)) / (1 - zeta(2, p.theta) / this->zeta_n);
+    }
+}
+uint64_t Generator::zipf() {
+    auto theta = this->phases[this->phase].theta;
+    auto u = (double)(random() >> 11) / (double)(1ULL << 53);
+    auto uz = u * this->zeta_n;
+    if (uz < 1) {
+        return 0;
+    }
+    if (uz < 1 + std::pow(0.5, theta)) {
+        return 1;
+    }
+    return std::min((uint64_t)((double)this->items * std::pow(this->eta * u - this->eta + 1, this->alpha)),
+                    this->items - 1);
+}
+bool Generator::next(SampleBatch &batch, size_t n) {
+    batch.clear();
+    while (batch.size() < n && this->phase < this->phases.size()) {
+        auto const &p = this->phases[this->phase];
+        if (this->done == p.samples) {
+            if (++this->phase < this->phases.size()) {
+                start_phase();
+            }
+            continue;
+        }
+        uint64_t item;
+        switch (p.pattern) {
+        case GEN_ZIPF:
+            // spread the ranks so the hot items are not one contiguous run
+            item = zipf() * 0x9e3779b97f4a7c15 % this->items;
+            break;
+        case GEN_SEQUENTIAL:
+            item = this->cursor;
+            this->cursor = (this->cursor + 1) % this->items;
+            break;
+        case GEN_CHASE:
+            item = this->cursor;
+            this->cursor = this->chain[this->cursor];
+            break;
+        default:
+            item = random() % this->items;
+        }
+        auto store = p.write_ratio > 0 && (double)(random() >> 11) / (double)(1ULL << 53) < p.write_ratio;
+        this->timestamp += this->period;
+        batch.push_back((uint64_t)this->timestamp, base + item * p.stride, phys_base + item * p.stride, 1,
+                        store ? ACCESS_STORE : ACCESS_LOAD);
+        this->done++;
+    }
+    return !batch.empty();
+}
+
+static std::optional<uint64_t> size_of(const std::string &value) {
+    size_t end = 0;
+    uint64_t n;
+    try {
+        n = std::stoull(value, &end, 0);
+    } catch (const std::exception &) {
+        return std::nullopt;
+    }
+    auto suffix = value.substr(end);
+    if (suffix == "K" || suffix == "k") {
+        return n << 10;
+    } else if (suffix == "M" || suffix == "m") {
+        return n << 20;
+    } else if (suffix == "G" || suffix == "g") {
+        return n << 30;
+    }
+    return suffix.empty() ? std::optional(n) : std::nullopt;
+}
+
+std::optional<std::vector<GeneratorPhase>> Generator::parse(const std::string &spec) {
+    std::vector<GeneratorPhase> phases;
+    std::stringstream phase_ss(spec);
+    for (std::string text; std::getline(phase_ss, text, ';');) {
+        std::stringstream ss(text);
+        std::string pattern;
+        std::getline(ss, pattern, ',');
+        GeneratorPhase p;
+        // the presets follow microbench/: ld and st move 128 bytes apart over a 1 GiB map, ptr-chasing stores then
+        // loads along a random chain
+        if (pattern == "uniform") {
+            p.pattern = GEN_UNIFORM;
+        } else if (pattern == "zipf") {
+            p.pattern = GEN_ZIPF;
+        } else if (pattern == "seq") {
+            p.pattern = GEN_SEQUENTIAL;
+        } else if (pattern == "chase") {
+            p.pattern = GEN_CHASE;
+        } else if (pattern == "ld" || pattern == "st") {
+            p.pattern = GEN_SEQUENTIAL;
+            p.stride = 128;
+            p.write_ratio = pattern == "st";
+        } else if (pattern == "ptr-chasing") {
+            p.pattern = GEN_CHASE;
+            p.footprint = 4 * 1024 * 1024;
+            p.write_ratio = 0.5;
+        } else {
+            LOG(ERROR) << fmt::format("Unknown generator pattern {}\n", pattern);
+            return std::nullopt;
+        }
+        for (std::string field; std::getline(ss, field, ',');) {
+            auto eq = field.find('=');
+            auto key = field.substr(0, eq);
+            auto value = eq == std::string::npos ? "" : field.substr(eq + 1);
+            std::optional<uint64_t> size;
+            if (key == "t" || key == "w") {
+                try {
+                    (key == "t" ? p.theta : p.write_ratio) = std::stod(value);
+                    continue;
+                } catch (const std::exception &) {
+                }
+            } else if ((size = size_of(value))) {
+                if (key == "n") {
+                    p.samples = *size;
+                    continue;
+                } else if (key == "f") {
+                    p.footprint = *size;
+                    continue;
+                } else if (key == "s") {
+                    p.stride = *size;
+                    continue;
+                }
+            }
+            LOG(ERROR) << fmt::format("Bad generator field {} in {}\n", field, text);
+            return std::nullopt;
+        }
+        if (p.stride == 0 || p.footprint < p.stride || p.theta <= 0 || p.theta >= 1 || p.write_ratio < 0 ||
+            p.write_ratio > 1 || (p.pattern == GEN_CHASE && p.footprint / p.stride > UINT32_MAX)) {
+            LOG(ERROR) << fmt::format("Generator phase {} out of range\n", text);
+            return std::nullopt;
+        }
+        phases.push_back(p);
+    }
+    if (phases.empty()) {
+        LOG(ERROR) << "Empty generator spec\n";
+        return std::nullopt;
+    }
+    return phases;
+}
@@ -2,6 +2,7 @@
 // Created by victoryang00 on 1/12/23.
 //
 #include "helper.h"
+#include "perfmon.h"
 #include <string>
 #include <vector>
 
@@ -43,6 +44,30 @@ int Helper::num_of_cha() {
     return ncha;
 }
 
+std::vector<int> Helper::uncore_cpus() {
+    std::vector<int> cpus;
+    for (auto path : {"/sys/bus/event_source/devices/uncore_cha_0/cpumask",
+                      "/sys/bus/event_source/devices/uncore_cbo_0/cpumask"}) {
+        std::ifstream fp(path);
+        std::string range;
+        // a cpu list such as 0,36 or 0-1
+        while (std::getline(fp, range, ',')) {
+            int first = 0, last = 0;
+            auto n = std::sscanf(range.c_str(), "%d-%d", &first, &last);
+            if (n < 1) {
+                continue;
+            }
+            for (auto c = first; c <= (n == 2 ? last : first); c++) {
+                cpus.push_back(c);
+            }
+        }
+        if (!cpus.empty()) {
+            return cpus;
+        }
+    }
+    return {0};
+}
+
 double Helper::cpu_frequency() {
     int i, c = 0;
     double cpu_mhz = 0.0;
@@ -60,28 +85,41 @@ double Helper::cpu_frequency() {
     return cpu_mhz;
 }
 PerfConfig Helper::detect_model(uint32_t model, const std::vector<std::string> &perf_name,
-                                const std::vector<uint64_t> &perf_conf1, const std::vector<uint64_t> &perf_conf2) {
+                                const std::vector<uint64_t> &perf_conf1, const std::vector<uint64_t> &perf_conf2,
+                                const PerfmonCatalog *catalog) {
     int i = 0;
     LOG(INFO) << fmt::format("Detecting model...{}\n", model);
-    while (model_ctx[i].model != CPU_MDL_END) {
-        if (model_ctx[i].model == model) {
-            this->perf_conf = model_ctx[i].perf_conf;
-            for (int j = 0; j < 4; ++j) {
-                this->perf_conf.cha[j] = std::make_tuple(perf_name[j], perf_conf1[j], perf_conf2[j]);
-            }
-            for (int j = 0; j < 4; ++j) {
-                this->perf_conf.cpu[j] = std::make_tuple(perf_name[j + 4], perf_conf1[j + 4], perf_conf2[j + 4]);
-            }
-            return this->perf_conf;
-        }
+    while (model_ctx[i].model != CPU_MDL_END && model_ctx[i].model != model) {
         i++;
     }
-    LOG(ERROR) << "Failed to execute. This CPU model is not supported. Refer to perfmon or pcm to add support\n";
-    throw;
+    auto known = model_ctx[i].model != CPU_MDL_END;
+    if (!known && (catalog == nullptr || catalog->events.empty())) {
+        LOG(ERROR) << "Failed to execute. This CPU model is not supported. Refer to perfmon or pcm to add support\n";
+        throw;
+    }
+    // perfmon knows the events but not the sysfs name, the CHAs are named the SKX way onwards
+    this->perf_conf = known ? model_ctx[i].perf_conf : PerfConfig{"/sys/bus/event_source/devices/uncore_cha_%u/type"};
+    auto slot = [&](int j, bool uncore) {
+        auto event = catalog != nullptr ? catalog->find(perf_name[j]) : std::nullopt;
+        if (event && event->uncore == uncore) {
+            LOG(INFO) << fmt::format("{}: config={:#x} config1={:#x} from perfmon\n", perf_name[j], event->config,
+                                     event->config1);
+            return std::make_tuple(perf_name[j], event->config, event->config1);
+        }
+        return std::make_tuple(perf_name[j], perf_conf1[j], perf_conf2[j]);
+    };
+    for (int j = 0; j < 4; ++j) {
+        this->perf_conf.cha[j] = slot(j, true);
+    }
+    for (int j = 0; j < 4; ++j) {
+        this->perf_conf.cpu[j] = slot(j + 4, false);
+    }
+    return this->perf_conf;
 }
 Helper::Helper() {
     cpu = num_of_cpu();
     cha = num_of_cha();
+    socket_cpu = uncore_cpus();
 }
 void Helper::noop_handler(int sig) { ; }
 void Helper::detach_children() {
@@ -109,9 +147,13 @@ int PMUInfo::start_all_pmcs() {
 PMUInfo::PMUInfo(pid_t pid, Helper *helper, struct PerfConfig *perf_config) : helper(helper) {
     int r;
 
-    for (auto i : helper->used_cpu) {
-        this->chas.emplace_back(i, perf_config);
+    for (auto cpu : helper->socket_cpu) {
+        for (int cha = 0; cha < helper->cha; cha++) {
+            this->chas.emplace_back(cha, cpu, perf_config);
+        }
     }
+    this->cha_last.resize(this->chas.size());
+    this->cha_delta.resize(this->chas.size());
     // unfreeze counters
     r = this->unfreeze_counters_cha_all();
     if (r < 0) {
@@ -122,12 +164,40 @@ PMUInfo::PMUInfo(pid_t pid, Helper *helper, struct PerfConfig *perf_config) : he
     for (auto i : helper->used_cpu) {
         this->cpus.emplace_back(pid, i, perf_config);
     }
+    this->cpu_last.resize(this->cpus.size());
+    this->cpu_delta.resize(this->cpus.size());
 
     r = this->start_all_pmcs();
     if (r < 0) {
         LOG(ERROR) << fmt::format("start_all_pmcs failed\n");
     }
 }
+int PMUInfo::read_chas() {
+    CHAElem now{};
+    for (auto const &[unit, cha] : this->chas | enumerate) {
+        if (cha.read_cha_elems(&now) < 0) {
+            return -1;
+        }
+        for (auto const &[idx, count] : now.cha | enumerate) {
+            this->cha_delta[unit].cha[idx] = count - this->cha_last[unit].cha[idx];
+        }
+        this->cha_last[unit] = now;
+    }
+    return 0;
+}
+int PMUInfo::read_cpus() {
+    CPUElem now{};
+    for (auto const &[unit, cpu] : this->cpus | enumerate) {
+        if (cpu.read_cpu_elems(&now) < 0) {
+            return -1;
+        }
+        for (auto const &[idx, count] : now.cpu | enumerate) {
+            this->cpu_delta[unit].cpu[idx] = count - this->cpu_last[unit].cpu[idx];
+        }
+        this->cpu_last[unit] = now;
+    }
+    return 0;
+}
 int PMUInfo::stop_all_pmcs() {
     /* disable all pmcs to count */
     int i, r;
@@ -146,12 +216,10 @@ int PMUInfo::unfreeze_counters_cha_all() {
     int i, r;
 
     for (i = 0; i < this->chas.size(); i++) {
-        for (int j : {0, 1, 2, 3}) {
-            r = this->chas[i].perf[j]->start();
-            if (r < 0) {
-                LOG(ERROR) << fmt::format("perf_start failed. cha:{}\n", i);
-                return r;
-            }
+        r = this->chas[i].start();
+        if (r < 0) {
+            LOG(ERROR) << fmt::format("perf_start failed. cha:{}\n", i);
+            return r;
         }
     }
     return 0;
@@ -160,12 +228,10 @@ int PMUInfo::freeze_counters_cha_all() {
     int i, r;
 
     for (i = 0; i < this->chas.size(); i++) {
-        for (int j : {0, 1, 2, 3}) {
-            r = this->chas[i].perf[j]->stop();
-            if (r < 0) {
-                LOG(ERROR) << fmt::format("perf_stop failed. cha:{}\n", i);
-                return r;
-            }
+        r = this->chas[i].stop();
+        if (r < 0) {
+            LOG(ERROR) << fmt::format("perf_stop failed. cha:{}\n", i);
+            return r;
         }
     }
     return 0;
@@ -12,39 +12,28 @@ void pcm_cpuid(const unsigned leaf, CPUID_INFO *info) {
 }
 
 int Incore::start() {
-    int i, r = -1;
-
-    for (i = 0; i < this->perf.size(); i++) {
-        r = this->perf[i]->start();
-        if (r < 0) {
-            LOG(ERROR) << fmt::format("perf_start failed. i:{}\n", i);
-            return r;
-        }
+    int r = this->perf[0]->start();
+    if (r < 0) {
+        LOG(ERROR) << fmt::format("perf_start failed.\n");
     }
     return r;
 }
 int Incore::stop() {
-    int i, r = -1;
-
-    for (i = 0; i < this->perf.size(); i++) {
-        r = this->perf[i]->stop();
-        if (r < 0) {
-            LOG(ERROR) << fmt::format("perf_stop failed. i:{}\n", i);
-            return r;
-        }
+    int r = this->perf[0]->stop();
+    if (r < 0) {
+        LOG(ERROR) << fmt::format("perf_stop failed.\n");
     }
     return r;
 }
 
 ssize_t Incore::read_cpu_elems(struct CPUElem *elem) {
-    ssize_t r;
-    for (auto const &[idx, value] : this->perf | enumerate) {
-        r = value->read_pmu(&elem->cpu[idx]);
-        if (r < 0) {
-            LOG(ERROR) << fmt::format("read cpu_elems[{}] failed.\n", std::get<0>(helper.perf_conf.cha[idx]));
-            return r;
-        }
-        LOG(DEBUG) << fmt::format("read cpu_elems[{}]:{}\n", std::get<0>(helper.perf_conf.cpu[idx]), elem->cpu[idx]);
+    ssize_t r = this->perf[0]->read_group(elem->cpu.data(), elem->cpu.size());
+    if (r < 0) {
+        LOG(ERROR) << fmt::format("read cpu_elems failed.\n");
+        return r;
+    }
+    for (auto const &[idx, value] : elem->cpu | enumerate) {
+        LOG(DEBUG) << fmt::format("read cpu_elems[{}]:{}\n", std::get<0>(helper.perf_conf.cpu[idx]), value);
     }
 
     return 0;
@@ -53,7 +42,8 @@ ssize_t Incore::read_cpu_elems(struct CPUElem *elem) {
 Incore::Incore(const pid_t pid, const int cpu, struct PerfConfig *perf_config) : perf_config(perf_config) {
     /* reset all pmc values */
     for (int i = 0; i < perf_config->cpu.size(); i++) {
-        this->perf[i] = init_incore_perf(pid, cpu, std::get<1>(perf_config->cpu[i]), std::get<2>(perf_config->cpu[i]));
+        this->perf[i] = init_incore_perf(pid, cpu, std::get<1>(perf_config->cpu[i]), std::get<2>(perf_config->cpu[i]),
+                                         i == 0 ? -1 : this->perf[0]->fd);
     }
 }
 
@@ -5,14 +5,19 @@
 #include "cxlendpoint.h"
 #include "helper.h"
 #include "monitor.h"
+#include "perfmon.h"
 #include "policy.h"
+#include "replay.h"
 #include "sock.h"
+#include "trace.h"
+#include <algorithm>
 #include <cerrno>
 #include <cmath>
 #include <cstdio>
 #include <cstdlib>
 #include <ctime>
 #include <cxxopts.hpp>
+#include <memory>
 #include <sys/poll.h>
 #include <sys/socket.h>
 #include <sys/un.h>
@@ -27,19 +32,20 @@ int main(int argc, char *argv[]) {
         "i,interval", "The value for epoch value", cxxopts::value<int>()->default_value("1000"))(
         "s,source", "Collection Phase or Validation Phase", cxxopts::value<bool>()->default_value("false"))(
         "c,cpuset", "The CPUSET for CPU to set affinity on and only run the target process on those CPUs",
-        cxxopts::value<std::vector<int>>()->default_value("0"))("d,dramlatency", "The current platform's dram latency",
-                                                                cxxopts::value<double>()->default_value("110"))(
+        cxxopts::value<std::vector<int>>()->default_value("0"))(
         "p,pebsperiod", "The pebs sample period", cxxopts::value<int>()->default_value("100"))(
-        "m,mode", "Page mode or cacheline mode", cxxopts::value<std::string>()->default_value("p"))(
-        "o,topology", "The newick tree input for the CXL memory expander topology",
-        cxxopts::value<std::string>()->default_value("(1,(2,3))"))(
-        "e,capacity", "The capacity vector of the CXL memory expander with the firsgt local",
-        cxxopts::value<std::vector<int>>()->default_value("0,20,20,20"))(
+        "storeperiod", "The pebs sample period of the retired stores, which far outnumber the L3 missing loads",
+        cxxopts::value<uint64_t>()->default_value("10000"))(
+        "r,ringsize", "The pebs ring size in KiB, a power of two from 64 to 16384",
+        cxxopts::value<size_t>()->default_value("64"))(
+        "drain", "Drain the pebs rings on threads pinned to these cores instead of at the epoch boundary",
+        cxxopts::value<std::vector<int>>())(
+        "drain_queue", "The samples queued per drain thread", cxxopts::value<size_t>()->default_value("65536"))(
+        "cpu_wide", "Sample with one pebs event per target core and keep the target's tasks, instead of one per task",
+        cxxopts::value<bool>()->default_value("false"))(
+        "sample_budget", "Adapt the pebs period toward this many samples per epoch per event, 0 keeps the period",
+        cxxopts::value<uint64_t>()->default_value("0"))(
         "f,frequency", "The frequency for the running thread", cxxopts::value<double>()->default_value("4000"))(
-        "l,latency", "The simulated latency by epoch based calculation for injected latency",
-        cxxopts::value<std::vector<int>>()->default_value("100,150,100,150,100,150"))(
-        "b,bandwidth", "The simulated bandwidth by linear regression",
-        cxxopts::value<std::vector<int>>()->default_value("50,50,50,50,50,50"))(
         "x,pmu_name", "The input for Collected PMU",
         cxxopts::value<std::vector<std::string>>()->default_value(
             "tatal_stall,all_dram_rds,l2stall,snoop_fw_wb,llcl_hits,llcl_miss,null,null"))(
@@ -47,10 +53,20 @@ int main(int argc, char *argv[]) {
         cxxopts::value<std::vector<uint64_t>>()->default_value("0x04004a3,0x01b7,0x05005a3,0x205c,0x08d2,0x01d3,0,0"))(
         "z,pmu_config2", "The config1 for Collected PMU",
         cxxopts::value<std::vector<uint64_t>>()->default_value("0,0x63FC00491,0,0,0,0,0,0"))(
+        "perfmon", "Resolve the -x names from the Intel perfmon json files in this directory",
+        cxxopts::value<std::string>()->default_value(""))(
+        "perfmon_cache", "The resolved perfmon table, by default next to the json files",
+        cxxopts::value<std::string>()->default_value(""))(
+        "record", "Record every PEBS sample and the epoch's counter deltas to this binary trace",
+        cxxopts::value<std::string>()->default_value(""))(
+        "record_direct", "Write the trace with O_DIRECT", cxxopts::value<bool>()->default_value("false"))(
+        "record_packed", "Write the trace samples delta and varint packed",
+        cxxopts::value<bool>()->default_value("false"))(
         "w,weight", "The weight for Linear Regression",
         cxxopts::value<std::vector<double>>()->default_value("88, 88, 88, 88, 88, 88, 88"))(
         "v,weight_vec", "The weight vector for Linear Regression",
         cxxopts::value<std::vector<double>>()->default_value("400, 800, 1200, 1600, 2000, 2400, 3000"));
+    add_model_options(options);
 
     auto result = options.parse(argc, argv);
     if (result["help"].as<bool>()) {
@@ -61,31 +77,20 @@ int main(int argc, char *argv[]) {
     auto interval = result["interval"].as<int>();
     auto cpuset = result["cpuset"].as<std::vector<int>>();
     auto pebsperiod = result["pebsperiod"].as<int>();
-    auto latency = result["latency"].as<std::vector<int>>();
-    auto bandwidth = result["bandwidth"].as<std::vector<int>>();
+    auto ringsize = result["ringsize"].as<size_t>() * 1024;
+    auto sample_budget = result["sample_budget"].as<uint64_t>();
     auto frequency = result["frequency"].as<double>();
-    auto topology = result["topology"].as<std::string>();
-    auto capacity = result["capacity"].as<std::vector<int>>();
     auto dramlatency = result["dramlatency"].as<double>();
     auto pmu_name = result["pmu_name"].as<std::vector<std::string>>();
     auto pmu_config1 = result["pmu_config1"].as<std::vector<uint64_t>>();
     auto pmu_config2 = result["pmu_config2"].as<std::vector<uint64_t>>();
+    auto perfmon = result["perfmon"].as<std::string>();
+    auto record = result["record"].as<std::string>();
     auto weight = result["weight"].as<std::vector<double>>();
     auto weight_vec = result["weight_vec"].as<std::vector<double>>();
     auto source = result["source"].as<bool>();
-    enum page_type mode;
-    if (result["mode"].as<std::string>() == "hugepage_2M") {
-        mode = page_type::HUGEPAGE_2M;
-    } else if (result["mode"].as<std::string>() == "hugepage_1G") {
-        mode = page_type::HUGEPAGE_1G;
-    } else if (result["mode"].as<std::string>() == "cacheline") {
-        mode = page_type::CACHELINE;
-    } else {
-        mode = page_type::PAGE;
-    }
 
     auto *policy = new InterleavePolicy();
-    CXLController *controller;
 
     uint64_t use_cpus = 0;
     cpu_set_t use_cpuset;
@@ -106,23 +111,7 @@ int main(int argc, char *argv[]) {
         LOG(DEBUG) << fmt::format("weight[{}]:{}\n", weight_vec[idx], value);
     }
 
-    for (auto const &[idx, value] : capacity | enumerate) {
-        if (idx == 0) {
-            LOG(DEBUG) << fmt::format("local_memory_region capacity:{}\n", value);
-            controller = new CXLController(policy, capacity[0], mode, interval);
-        } else {
-            LOG(DEBUG) << fmt::format("memory_region:{}\n", (idx - 1) + 1);
-            LOG(DEBUG) << fmt::format(" capacity:{}\n", capacity[(idx - 1) + 1]);
-            LOG(DEBUG) << fmt::format(" read_latency:{}\n", latency[(idx - 1) * 2]);
-            LOG(DEBUG) << fmt::format(" write_latency:{}\n", latency[(idx - 1) * 2 + 1]);
-            LOG(DEBUG) << fmt::format(" read_bandwidth:{}\n", bandwidth[(idx - 1) * 2]);
-            LOG(DEBUG) << fmt::format(" write_bandwidth:{}\n", bandwidth[(idx - 1) * 2 + 1]);
-            auto *ep = new CXLMemExpander(bandwidth[(idx - 1) * 2], bandwidth[(idx - 1) * 2 + 1],
-                                          latency[(idx - 1) * 2], latency[(idx - 1) * 2 + 1], (idx - 1), capacity[idx]);
-            controller->insert_end_point(ep);
-        }
-    }
-    controller->construct_topo(topology);
+    auto *controller = ControllerConfig::from(result).build(policy);
     LOG(INFO) << controller->output() << "\n";
     int sock;
     struct sockaddr_un addr {};
@@ -145,9 +134,33 @@ int main(int argc, char *argv[]) {
     LOG(DEBUG) << fmt::format("num_of_cpu:{}\n", ncpu);
     for (auto j : cpuset) {
         helper.used_cpu.push_back(cpuset[j]);
-        helper.used_cha.push_back(cpuset[j]);
+    }
+    // the CHAs are shared by the whole socket, so every one is counted once whichever cpus the targets use
+    for (int unit = 0; unit < helper.cha * (int)helper.socket_cpu.size(); unit++) {
+        helper.used_cha.push_back(unit);
     }
     Monitors monitors{tnum, &use_cpuset};
+    if (!PEBS::valid_ring_size(ringsize)) {
+        LOG(ERROR) << fmt::format("Invalid pebs ring size {}KiB\n", ringsize / 1024);
+        exit(1);
+    }
+    monitors.pebs_ring_size = ringsize;
+    monitors.store_sample_period = std::max<uint64_t>(result["storeperiod"].as<uint64_t>(), 1);
+    if (result.count("drain")) {
+        for (auto cpu : result["drain"].as<std::vector<int>>()) {
+            // keep the drain threads off the cores the targets are pinned to
+            if (std::ranges::any_of(monitors.mon, [cpu](const Monitor &m) { return (int)m.cpu_core == cpu; })) {
+                LOG(ERROR) << fmt::format("Drain cpu {} runs a target, skipped\n", cpu);
+                continue;
+            }
+            monitors.drain_cpus.push_back(cpu);
+        }
+        monitors.drain_queue_size = result["drain_queue"].as<size_t>();
+    }
+    if (result["cpu_wide"].as<bool>()) {
+        monitors.cpu_wide = true;
+        monitors.enable_cpu_wide(pebsperiod);
+    }
 
     /** Reinterpret the input for the argv argc */
     char cmd_buf[1024] = {0};
@@ -202,9 +215,18 @@ int main(int argc, char *argv[]) {
     if (!get_cpu_info(&monitors.mon[0].before->cpuinfo)) {
         LOG(DEBUG) << "Failed to obtain CPU information.\n";
     }
-    auto perf_config =
-        helper.detect_model(monitors.mon[0].before->cpuinfo.cpu_model, pmu_name, pmu_config1, pmu_config2);
+    auto cpu_model = monitors.mon[0].before->cpuinfo.cpu_model;
+    PerfmonCatalog catalog;
+    if (!perfmon.empty() && !catalog.load(perfmon, cpu_model, result["perfmon_cache"].as<std::string>())) {
+        LOG(ERROR) << fmt::format("No perfmon events loaded from {}, using the raw configs\n", perfmon);
+    }
+    auto perf_config = helper.detect_model(cpu_model, pmu_name, pmu_config1, pmu_config2, &catalog);
     PMUInfo pmu{t_process, &helper, &perf_config};
+    std::unique_ptr<TraceWriter> trace;
+    if (!record.empty()) {
+        trace = std::make_unique<TraceWriter>(record, cpu_model, interval, pebsperiod,
+                                              result["record_direct"].as<bool>(), result["record_packed"].as<bool>());
+    }
 
     /*% Caculate epoch time */
     struct timespec waittime {};
@@ -217,16 +239,18 @@ int main(int argc, char *argv[]) {
     monitors.print_flag = false;
 
     /* read CHA params */
+    pmu.read_chas();
+    if (trace) {
+        pmu.read_cpus();
+    }
     for (const auto &mon : monitors.mon) {
-        for (auto const &[idx, value] : pmu.chas | enumerate) {
-            pmu.chas[idx].read_cha_elems(&mon.before->chas[idx]);
-        }
         for (auto const &[idx, value] : pmu.cpus | enumerate) {
             pmu.cpus[idx].read_cpu_elems(&mon.before->cpus[idx]);
         }
     }
 
     uint32_t diff_nsec = 0;
+    uint64_t epoch = 0;
     struct timespec start_ts {
     }, end_ts{};
     struct timespec sleep_start_ts {
@@ -258,7 +282,12 @@ int main(int argc, char *argv[]) {
                 LOG(ERROR) << fmt::format("received data: size={}, tgid={}, tid=[], opcode={}\n", n, opd->tgid,
                                           opd->tid, opd->opcode);
 
-                if (opd->opcode == CXLMEMSIM_THREAD_CREATE || opd->opcode == CXLMEMSIM_PROCESS_CREATE) {
+                if (monitors.cpu_wide && opd->opcode == CXLMEMSIM_THREAD_CREATE) {
+                    // a thread needs no monitor slot, only to pass the filter of the per cpu events
+                    monitors.filter.add(opd->tgid, opd->tid, false);
+                } else if (monitors.cpu_wide && opd->opcode == CXLMEMSIM_THREAD_EXIT) {
+                    monitors.filter.remove(opd->tgid, opd->tid, false);
+                } else if (opd->opcode == CXLMEMSIM_THREAD_CREATE || opd->opcode == CXLMEMSIM_PROCESS_CREATE) {
                     int t;
                     bool is_process = opd->opcode == CXLMEMSIM_PROCESS_CREATE;
                     // register to monitor
@@ -273,12 +302,9 @@ int main(int argc, char *argv[]) {
                     auto mon = monitors.mon[t];
                     // Wait the t processes until emulation process initialized.
                     mon.stop();
-                    /* read CHA params */
-                    for (auto const &[idx, value] : pmu.chas | enumerate) {
-                        pmu.chas[idx].read_cha_elems(&mon.before->chas[idx]);
-                    }
-                    for (auto const &[idx, value] : pmu.chas | enumerate) {
-                        pmu.chas[idx].read_cha_elems(&mon.before->chas[idx]);
+                    /* read CPU params, the CHAs are read once for every monitor at the epoch boundary */
+                    for (auto const &[idx, value] : pmu.cpus | enumerate) {
+                        value.read_cpu_elems(&mon.before->cpus[idx]);
                     }
                     // Run the t processes.
                     mon.run();
@@ -329,6 +355,34 @@ int main(int argc, char *argv[]) {
         }
 
         uint64_t calibrated_delay;
+        auto trace_ns = trace ? trace->write_ns : 0;
+        if (pmu.read_chas() < 0) {
+            LOG(ERROR) << "Warning: Failed CHA read\n";
+        }
+        if (trace && pmu.read_cpus() < 0) {
+            LOG(ERROR) << "Warning: Failed CPU read\n";
+        }
+        if (monitors.cpu_wide) {
+            auto before = monitors.cpu_wide_elem;
+            if (monitors.read_cpu_wide(controller) < 0) {
+                LOG(ERROR) << "Warning: Failed cpu wide PEBS read\n";
+            }
+            auto &after = monitors.cpu_wide_elem;
+            if (trace) {
+                trace->samples(epoch, TRACE_CPU_WIDE, monitors.cpu_wide_batch);
+            }
+            auto pebs_batch = (double)monitors.cpu_wide_batch.size();
+            LOG(DEBUG) << fmt::format("cpu wide pebs: taken={}, dropped={}, decode {:.0f} samples/s, ingest {:.0f} "
+                                      "samples/s\n",
+                                      after.total - before.total,
+                                      after.lost - before.lost + after.lost_samples - before.lost_samples,
+                                      pebs_batch * 1e9 / (double)(monitors.cpu_wide_decode_ns + 1),
+                                      pebs_batch * 1e9 / (double)(monitors.cpu_wide_ingest_ns + 1));
+            if (sample_budget != 0) {
+                LOG(DEBUG) << fmt::format("cpu wide pebs: weight {:.3f}, next period {}\n",
+                                          monitors.cpu_wide_batch.weight, monitors.adapt_cpu_wide(sample_budget));
+            }
+        }
         for (auto const &[i, mon] : monitors.mon | enumerate) {
             // check other process
             if (mon.status == MONITOR_DISABLE) {
@@ -339,21 +393,15 @@ int main(int argc, char *argv[]) {
                 LOG(DEBUG) << fmt::format("[{}:{}:{}] start_ts: {}.{}\n", i, mon.tgid, mon.tid, start_ts.tv_sec,
                                           start_ts.tv_nsec);
                 mon.stop();
-                /** Read CHA values */
+                /** CHA values were read once above and are split among the monitors after the loop */
                 uint64_t wb_cnt = 0;
-                std::vector<uint64_t> cha_vec, cpu_vec{};
+                std::vector<uint64_t> cpu_vec{};
                 // for (int j = 0; j < ncha; j++) {
                 //     pmu.chas[j].read_cha_elems(&mon.after->chas[j]);
                 //     wb_cnt += mon.after->chas[j].cpu_llc_wb - mon.before->chas[j].cpu_llc_wb;
                 // }
                 // LOG(INFO) << fmt::format("[{}:{}:{}] LLC_WB = {}\n", i, mon.tgid, mon.tid, wb_cnt);
                 // }
-                for (int j = 0; j < helper.used_cha.size(); j++) {
-                    for (auto const &[idx, value] : pmu.chas | enumerate) {
-                        value.read_cha_elems(&mon.after->chas[j]);
-                        cha_vec.emplace_back(mon.after->chas[j].cha[idx] - mon.before->chas[j].cha[idx]);
-                    }
-                }
                 /*** read CPU params */
                 uint64_t read_config = 0;
                 uint64_t target_l2stall = 0, target_llcmiss = 0, target_llchits = 0;
@@ -361,9 +409,41 @@ int main(int argc, char *argv[]) {
                 //     pmu.cpus[j].read_cpu_elems(&mon.after->cpus[j]);
                 //     read_config += mon.after->cpus[j].cpu_bandwidth - mon.before->cpus[j].cpu_bandwidth;
                 // }
-                /* read PEBS sample */
-                if (mon.pebs_ctx->read(controller, &mon.after->pebs) < 0) {
-                    LOG(ERROR) << fmt::format("[{}:{}:{}] Warning: Failed PEBS read\n", i, mon.tgid, mon.tid);
+                /* read PEBS sample, in cpu wide mode the per cpu rings were read for everyone above */
+                if (mon.pebs_ctx != nullptr) {
+                    if (mon.pebs_ctx->read(controller, &mon.after->pebs) < 0) {
+                        LOG(ERROR) << fmt::format("[{}:{}:{}] Warning: Failed PEBS read\n", i, mon.tgid, mon.tid);
+                    }
+                    if (trace) {
+                        trace->samples(epoch, i, mon.pebs_ctx->batch);
+                    }
+                    /* the drops of the read are already in the batch weight the model charged the samples at */
+                    auto pebs_taken = mon.after->pebs.total - mon.before->pebs.total;
+                    auto pebs_dropped = mon.after->pebs.lost - mon.before->pebs.lost + mon.after->pebs.lost_samples -
+                                        mon.before->pebs.lost_samples;
+                    mon.epoch_samples = pebs_taken;
+                    LOG(DEBUG) << fmt::format("[{}:{}:{}] pebs: taken={}, dropped={}, weight={:.3f}\n", i, mon.tgid,
+                                              mon.tid, pebs_taken, pebs_dropped, mon.pebs_ctx->batch.weight);
+                    auto pebs_batch = (double)mon.pebs_ctx->batch.size();
+                    LOG(DEBUG) << fmt::format("[{}:{}:{}] pebs: decode {:.0f} samples/s, ingest {:.0f} samples/s\n",
+                                              i, mon.tgid, mon.tid,
+                                              pebs_batch * 1e9 / (double)(mon.pebs_ctx->decode_ns + 1),
+                                              pebs_batch * 1e9 / (double)(mon.pebs_ctx->ingest_ns + 1));
+                    if (mon.pebs_ctx->queue) {
+                        LOG(DEBUG) << fmt::format(
+                            "[{}:{}:{}] pebs drain: latency {}ns, high water {}/{}, overflow {}\n", i, mon.tgid,
+                            mon.tid, mon.pebs_ctx->drain_latency_ns.exchange(0), mon.pebs_ctx->drain_high_water.load(),
+                            mon.pebs_ctx->queue->capacity(), mon.pebs_ctx->drain_overflow.load());
+                    }
+                    /* the samples of this epoch went in at the old period's weight, the new one applies from now */
+                    if (sample_budget != 0) {
+                        LOG(DEBUG) << fmt::format("[{}:{}:{}] pebs: weight {:.3f}, next period {}\n", i, mon.tgid,
+                                                  mon.tid, mon.pebs_ctx->batch.weight,
+                                                  mon.pebs_ctx->adapt_period(sample_budget));
+                    }
+                } else if (trace) {
+                    /* the monitor is charged below all the same, the replay charges it on this empty record */
+                    trace->samples(epoch, i, SampleBatch{});
                 }
                 // target_llcmiss = mon.after->pebs.total - mon.before->pebs.total;
 
@@ -375,11 +455,10 @@ int main(int argc, char *argv[]) {
                 //      target_l2stall += mon.after->cpus[idx].cpu_l2stall_t - mon.before->cpus[idx].cpu_l2stall_t;
                 //      target_llchits += mon.after->cpus[idx].cpu_llcl_hits - mon.before->cpus[idx].cpu_llcl_hits;
                 //  }
-                for (int j = 0; j < helper.used_cpu.size(); j++) {
-                    for (auto const &[idx, value] : pmu.cpus | enumerate) {
-                        value.read_cpu_elems(&mon.after->cpus[j]);
-                        //                        wb_cnt = mon.after->cpus[j].cpu[idx] - mon.before->cpus[j].cpu[idx];
-                        cpu_vec.emplace_back(mon.after->cpus[j].cpu[idx] - mon.before->cpus[j].cpu[idx]);
+                for (auto const &[j, value] : pmu.cpus | enumerate) {
+                    value.read_cpu_elems(&mon.after->cpus[j]);
+                    for (auto const &[idx, count] : mon.after->cpus[j].cpu | enumerate) {
+                        cpu_vec.emplace_back(count - mon.before->cpus[j].cpu[idx]);
                     }
                 }
                 uint64_t llcmiss_wb = 0;
@@ -404,29 +483,14 @@ int main(int argc, char *argv[]) {
                 LOG(DEBUG) << fmt::format("[{}:{}:{}]llcmiss_wb={}, llcmiss_ro={}\n", i, mon.tgid, mon.tid, llcmiss_wb,
                                           llcmiss_ro);
 
-                uint64_t emul_delay = 0;
-
                 LOG(DEBUG) << fmt::format("[{}:{}:{}] pebs: total={}, \n", i, mon.tgid, mon.tid, mon.after->pebs.total);
 
                 /** TODO: calculate latency construct the passing value and use interleaving policy and counter to get
                  * the sample_prop */
-                auto all_access = controller->get_all_access();
-                LatencyPass lat_pass = {
-                    .all_access = all_access,
-                    .dramlatency = dramlatency,
-                    .readonly = llcmiss_ro,
-                    .writeback = llcmiss_wb,
-                };
-                BandwidthPass bw_pass = {
-                    .all_access = all_access,
-                    .read_config = read_config,
-                    .write_config = read_config,
-                };
-                emul_delay += std::lround(controller->calculate_latency(lat_pass));
-                emul_delay += controller->calculate_bandwidth(bw_pass);
-                emul_delay += std::get<0>(controller->calculate_congestion());
-
-                mon.before->pebs.total = mon.after->pebs.total;
+                uint64_t emul_delay = epoch_delay(controller, dramlatency, llcmiss_ro, llcmiss_wb, read_config);
+                LOG(DEBUG) << controller->topology.port_output();
+
+                mon.before->pebs = mon.after->pebs;
 
                 LOG(DEBUG) << fmt::format("delay={}\n", emul_delay);
 
@@ -486,6 +550,14 @@ int main(int argc, char *argv[]) {
                 }
             }
         } // End for-loop for all target processes
+        LOG(DEBUG) << fmt::format("aged out {} occupation entries\n", controller->age_out());
+        monitors.attribute_chas(pmu.cha_delta);
+        if (trace) {
+            trace->epoch(epoch, pmu.cha_delta, pmu.cpu_delta);
+            LOG(DEBUG) << fmt::format("trace: {} bytes, {}ns writing this epoch\n", trace->bytes,
+                                      trace->write_ns - trace_ns);
+        }
+        epoch++;
         LOG(TRACE) << fmt::format("{}\n", monitors);
         for (auto mon : monitors.mon) {
             if (mon.status == MONITOR_ON) {
@@ -507,6 +579,9 @@ int main(int argc, char *argv[]) {
             break;
         }
     } // End while-loop for emulation
+    if (trace) {
+        trace->close();
+    }
 
     return 0;
 }
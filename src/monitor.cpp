@@ -3,6 +3,7 @@
 //
 
 #include "monitor.h"
+#include <algorithm>
 Monitors::Monitors(int tnum, cpu_set_t *use_cpuset) : print_flag(true) {
     mon = std::vector<Monitor>(tnum, Monitor());
     /** Init mon */
@@ -20,6 +21,100 @@ Monitors::Monitors(int tnum, cpu_set_t *use_cpuset) : print_flag(true) {
         }
     }
 }
+Monitors::~Monitors() {
+    for (auto pebs : cpu_pebs) {
+        delete pebs;
+    }
+}
+void Monitors::enable_cpu_wide(uint64_t pebs_sample_period) {
+    std::vector<int> cores;
+    for (auto &m : mon) {
+        if (std::ranges::find(cores, (int)m.cpu_core) == cores.end()) {
+            cores.push_back((int)m.cpu_core);
+        }
+    }
+    for (auto const &[idx, core] : cores | enumerate) {
+        auto pebs = new PEBS(-1, pebs_sample_period, store_sample_period, pebs_ring_size, core, &filter);
+        if (!drain_cpus.empty()) {
+            pebs->start_drain(drain_cpus[idx % drain_cpus.size()], drain_queue_size);
+        }
+        cpu_pebs.push_back(pebs);
+        LOG(DEBUG) << fmt::format("cpu {}: enable to pebs.\n", core);
+    }
+}
+int Monitors::read_cpu_wide(CXLController *controller) {
+    int r = 0;
+    struct timespec start_ts {}, decoded_ts {}, end_ts {};
+
+    clock_gettime(CLOCK_MONOTONIC, &start_ts);
+    cpu_wide_batch.clear();
+    auto dropped = cpu_wide_elem.lost + cpu_wide_elem.lost_samples;
+    for (auto pebs : cpu_pebs) {
+        if (pebs->collect(cpu_wide_batch, &cpu_wide_elem) < 0) {
+            r = -1;
+        }
+    }
+    dropped = cpu_wide_elem.lost + cpu_wide_elem.lost_samples - dropped;
+    cpu_wide_batch.sort_by_time();
+    auto scale = PEBS::loss_scale(cpu_wide_batch.size(), dropped);
+    cpu_wide_batch.weight = (cpu_pebs.empty() ? 1. : cpu_pebs.front()->weight()) * scale;
+    cpu_wide_batch.store_weight = (cpu_pebs.empty() ? 1. : cpu_pebs.front()->store_weight()) * scale;
+    clock_gettime(CLOCK_MONOTONIC, &decoded_ts);
+
+    controller->insert_batch(cpu_wide_batch);
+    cpu_wide_elem.total += cpu_wide_batch.size();
+    clock_gettime(CLOCK_MONOTONIC, &end_ts);
+    cpu_wide_decode_ns =
+        (decoded_ts.tv_sec - start_ts.tv_sec) * 1000000000 + (decoded_ts.tv_nsec - start_ts.tv_nsec);
+    cpu_wide_ingest_ns = (end_ts.tv_sec - decoded_ts.tv_sec) * 1000000000 + (end_ts.tv_nsec - decoded_ts.tv_nsec);
+    return r;
+}
+uint64_t Monitors::adapt_cpu_wide(uint64_t budget) {
+    if (cpu_pebs.empty()) {
+        return 0;
+    }
+    uint64_t records = 0, store_records = 0;
+    bool throttled = false, stores = false;
+    for (auto pebs : cpu_pebs) {
+        records += pebs->records.exchange(0);
+        store_records += pebs->store_records.exchange(0);
+        throttled |= pebs->throttles.exchange(0) != 0;
+        stores |= pebs->store_fd != -1;
+    }
+    auto period = PEBS::next_period(cpu_pebs.front()->sample_period, records, budget, throttled);
+    auto store_period = cpu_pebs.front()->store_period;
+    if (stores) {
+        store_period = PEBS::next_period(store_period, store_records, budget, throttled);
+    }
+    for (auto pebs : cpu_pebs) {
+        if (period != pebs->sample_period || store_period != pebs->store_period) {
+            pebs->set_period(period, store_period);
+        }
+    }
+    return cpu_pebs.front()->sample_period;
+}
+void Monitors::attribute_chas(const std::vector<CHAElem> &delta) {
+    uint64_t total = 0;
+    size_t active = 0;
+    for (auto &m : mon) {
+        if (m.status != MONITOR_DISABLE) {
+            total += m.epoch_samples;
+            active++;
+        }
+    }
+    for (auto &m : mon) {
+        if (m.status == MONITOR_DISABLE) {
+            continue;
+        }
+        auto share = total != 0 ? (double)m.epoch_samples / (double)total : 1. / (double)active;
+        for (auto const &[unit, elem] : delta | enumerate) {
+            for (auto const &[idx, count] : elem.cha | enumerate) {
+                m.after->chas[unit].cha[idx] = m.before->chas[unit].cha[idx] + std::llround(share * (double)count);
+            }
+        }
+        m.epoch_samples = 0;
+    }
+}
 void Monitors::stop_all(const int processes) {
     for (auto i = 0; i < processes; ++i) {
         if (mon[i].status == MONITOR_ON) {
@@ -86,9 +181,15 @@ int Monitors::enable(const uint32_t tgid, const uint32_t tid, bool is_process, u
     mon[target].tid = tid; // We can setup the process here
     mon[target].is_process = is_process;
 
-    if (pebs_sample_period) {
+    if (cpu_wide) {
+        /* the per cpu events pick the task up through the filter */
+        filter.add(tgid, tid, is_process);
+    } else if (pebs_sample_period) {
         /* pebs start */
-        mon[target].pebs_ctx = new PEBS(tgid, pebs_sample_period);
+        mon[target].pebs_ctx = new PEBS(tgid, pebs_sample_period, store_sample_period, pebs_ring_size);
+        if (!drain_cpus.empty()) {
+            mon[target].pebs_ctx->start_drain(drain_cpus[target % drain_cpus.size()], drain_queue_size);
+        }
         LOG(DEBUG) << fmt::format("{}Process [tgid={}, tid={}]: enable to pebs.\n", target, mon[target].tgid,
                                   mon[target].tid); // multiple tid multiple pid
     }
@@ -113,6 +214,7 @@ void Monitors::disable(const uint32_t target) {
     mon[target].end_exec_ts.tv_nsec = 0;
     if (mon[target].pebs_ctx != nullptr) {
         mon[target].pebs_ctx->fd = -1;
+        mon[target].pebs_ctx->store_fd = -1;
         mon[target].pebs_ctx->pid = -1;
         mon[target].pebs_ctx->seq = 0;
         mon[target].pebs_ctx->rdlen = 0;
@@ -123,6 +225,8 @@ void Monitors::disable(const uint32_t target) {
     for (auto &j : mon[target].elem) {
         j.pebs.total = 0;
         j.pebs.llcmiss = 0;
+        j.pebs.lost = 0;
+        j.pebs.lost_samples = 0;
     }
 }
 bool Monitors::check_all_terminated(const uint32_t processes) {
@@ -150,9 +254,6 @@ int Monitors::terminate(const uint32_t tgid, const uint32_t tid, const int32_t t
             continue;
         }
         target = i;
-        /* pebs stop */
-        delete mon[target].pebs_ctx;
-
         /* Save end time */
         if (mon[target].end_exec_ts.tv_sec == 0 && mon[target].end_exec_ts.tv_nsec == 0) {
             clock_gettime(CLOCK_MONOTONIC, &mon[i].end_exec_ts);
@@ -167,6 +268,20 @@ int Monitors::terminate(const uint32_t tgid, const uint32_t tid, const int32_t t
         std::cout << fmt::format("total delay   ={}\n", mon[target].total_delay);
 
         std::cout << fmt::format("PEBS sample total {}\n", mon[target].before->pebs.total);
+        std::cout << fmt::format("PEBS lost records {} lost samples {}\n", mon[target].before->pebs.lost,
+                                 mon[target].before->pebs.lost_samples);
+        if (mon[target].pebs_ctx != nullptr && mon[target].pebs_ctx->queue) {
+            std::cout << fmt::format("PEBS drain queue high water {} overflow {}\n",
+                                     mon[target].pebs_ctx->drain_high_water.load(),
+                                     mon[target].pebs_ctx->drain_overflow.load());
+        }
+
+        /* pebs stop */
+        if (cpu_wide) {
+            filter.remove(mon[target].tgid, mon[target].tid, mon[target].is_process);
+        }
+        delete mon[target].pebs_ctx;
+        mon[target].pebs_ctx = nullptr;
 
         /* init */
         disable(target);
@@ -0,0 +1,104 @@
+#include "occupation.h"
+
+uint32_t Occupation::alloc_slot() {
+    if (free_slot != npos) {
+        auto slot = free_slot;
+        free_slot = entries[slot].next;
+        return slot;
+    }
+    entries.push_back({});
+    return entries.size() - 1;
+}
+void Occupation::link_tail(uint32_t slot) {
+    auto &e = entries[slot];
+    e.prev = tail;
+    e.next = npos;
+    if (tail != npos) {
+        entries[tail].next = slot;
+    } else {
+        head = slot;
+    }
+    tail = slot;
+}
+void Occupation::unlink(uint32_t slot) {
+    auto &e = entries[slot];
+    if (e.prev != npos) {
+        entries[e.prev].next = e.next;
+    } else {
+        head = e.next;
+    }
+    if (e.next != npos) {
+        entries[e.next].prev = e.prev;
+    } else {
+        tail = e.prev;
+    }
+}
+void Occupation::release(uint32_t slot) {
+    unlink(slot);
+    entries[slot].next = free_slot;
+    free_slot = slot;
+    count--;
+}
+std::pair<OccupationEntry *, bool> Occupation::insert(uint64_t timestamp, uint64_t address, uint64_t virt_addr) {
+    address = unit(address);
+    virt_addr = unit(virt_addr);
+    auto [it, inserted] = index.try_emplace(address, npos);
+    if (!inserted) {
+        // touch: move to the newest end of the time order
+        auto slot = it->second;
+        entries[slot].last_touch = timestamp;
+        entries[slot].virt_addr = virt_addr;
+        if (slot != tail) {
+            unlink(slot);
+            link_tail(slot);
+        }
+        return {&entries[slot], true};
+    }
+    auto slot = alloc_slot();
+    entries[slot] = {
+        .first_touch = timestamp,
+        .last_touch = timestamp,
+        .address = address,
+        .virt_addr = virt_addr,
+        .reads = 0,
+        .writes = 0,
+    };
+    link_tail(slot);
+    it->second = slot;
+    ordered.emplace_hint(ordered.end(), address, slot); // streams mostly grow upwards
+    count++;
+    return {&entries[slot], false};
+}
+bool Occupation::erase(uint64_t address) {
+    address = unit(address);
+    auto it = index.find(address);
+    if (it == index.end()) {
+        return false;
+    }
+    release(it->second);
+    ordered.erase(address);
+    index.erase(it);
+    return true;
+}
+bool Occupation::contains(uint64_t address) const { return index.contains(unit(address)); }
+bool Occupation::evict_oldest() {
+    if (head == npos) {
+        return false;
+    }
+    index.erase(entries[head].address);
+    ordered.erase(entries[head].address);
+    release(head);
+    return true;
+}
+const OccupationEntry *Occupation::oldest() const { return head == npos ? nullptr : &entries[head]; }
+void Occupation::reserve(size_t n) {
+    entries.reserve(n);
+    index.reserve(n);
+}
+void Occupation::clear() {
+    entries.clear();
+    index.clear();
+    ordered.clear();
+    head = tail = free_slot = npos;
+    count = 0;
+}
@@ -3,10 +3,12 @@
 //
 
 #include "pebs.h"
+#include <algorithm>
+#include <cmath>
+#include <poll.h>
+#include <pthread.h>
 
 #define PAGE_SIZE 4096
-#define DATA_SIZE PAGE_SIZE
-#define MMAP_SIZE (PAGE_SIZE + DATA_SIZE)
 
 #define barrier() _mm_mfence()
 
@@ -16,47 +18,81 @@ struct perf_sample {
     uint32_t tid;
     uint64_t timestamp;
     uint64_t addr;
+    uint64_t id;
     uint64_t value;
     uint64_t time_enabled;
     uint64_t phys_addr;
 };
 
+struct perf_lost {
+    struct perf_event_header header;
+    uint64_t id;
+    uint64_t lost;
+};
+
+struct perf_lost_samples {
+    struct perf_event_header header;
+    uint64_t lost;
+};
+
 long perf_event_open(struct perf_event_attr *event_attr, pid_t pid, int cpu, int group_fd, unsigned long flags) {
     return syscall(__NR_perf_event_open, event_attr, pid, cpu, group_fd, flags);
 }
-PEBS::PEBS(pid_t pid, uint64_t sample_period) : pid(pid), sample_period(sample_period) {
+PEBS::PEBS(pid_t pid, uint64_t sample_period, uint64_t store_period, size_t data_size, int cpu, TaskFilter *filter)
+    : pid(pid), cpu(cpu), filter(filter), sample_period(sample_period), base_period(sample_period),
+      store_period(store_period), store_base_period(store_period), data_size(data_size) {
     // Configure perf_event_attr struct
     struct perf_event_attr pe = {
         .type = PERF_TYPE_RAW,
         .size = sizeof(struct perf_event_attr),
         .config = 0x20d1, // mem_load_retired.l3_miss
         .sample_period = sample_period,
-        .sample_type = PERF_SAMPLE_TID | PERF_SAMPLE_TIME | PERF_SAMPLE_ADDR | PERF_SAMPLE_READ | PERF_SAMPLE_PHYS_ADDR,
+        .sample_type = PERF_SAMPLE_TID | PERF_SAMPLE_TIME | PERF_SAMPLE_ADDR | PERF_SAMPLE_ID | PERF_SAMPLE_READ |
+                       PERF_SAMPLE_PHYS_ADDR,
         .read_format = PERF_FORMAT_TOTAL_TIME_ENABLED,
         .disabled = 1, // Event is initially disabled
         .exclude_kernel = 1,
         .precise_ip = 1,
         .config1 = 3,
     }; // excluding events that happen in the kernel-space
+    pe.watermark = 1; // wake a polling drain thread once a quarter of the ring is filled
+    pe.wakeup_watermark = data_size / 4;
+    pe.use_clockid = 1; // sample timestamps on the same clock as clock_gettime, for the drain latency
+    pe.clockid = CLOCK_MONOTONIC;
 
-    int cpu = -1; // measure on any cpu
     int group_fd = -1;
     unsigned long flags = 0;
 
-    this->fd = perf_event_open(&pe, pid, cpu, group_fd, flags);
+    // the task on any cpu, or every task on one cpu
+    this->fd = perf_event_open(&pe, cpu == -1 ? pid : -1, cpu, group_fd, flags);
     if (this->fd == -1) {
         perror("perf_event_open");
         throw;
     }
 
-    this->mplen = MMAP_SIZE;
-    this->mp = (perf_event_mmap_page *)mmap(nullptr, MMAP_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, this->fd, 0);
+    this->mplen = PAGE_SIZE + data_size;
+    this->mp = (perf_event_mmap_page *)mmap(nullptr, this->mplen, PROT_READ | PROT_WRITE, MAP_SHARED, this->fd, 0);
 
     if (this->mp == MAP_FAILED) {
         perror("mmap");
         throw;
     }
 
+    // retired stores with their data address, redirected into the load ring (which must be mapped first) and told
+    // apart by the sample id
+    pe.config = 0x82d0; // mem_inst_retired.all_stores
+    pe.config1 = 0;
+    pe.sample_period = store_period;
+    this->store_fd = perf_event_open(&pe, cpu == -1 ? pid : -1, cpu, group_fd, flags);
+    if (this->store_fd != -1 && (ioctl(this->store_fd, PERF_EVENT_IOC_SET_OUTPUT, this->fd) < 0 ||
+                                 ioctl(this->store_fd, PERF_EVENT_IOC_ID, &this->store_id) < 0)) {
+        close(this->store_fd);
+        this->store_fd = -1;
+    }
+    if (this->store_fd == -1) {
+        LOG(INFO) << "store sampling unavailable, writes fall back to first touch\n";
+    }
+
     this->start();
 }
 int PEBS::read(CXLController *controller, struct PEBSElem *elem) {
@@ -67,68 +103,233 @@ int PEBS::read(CXLController *controller, struct PEBSElem *elem) {
     if (mp == MAP_FAILED)
         return -1;
 
+    struct timespec start_ts {}, decoded_ts {}, end_ts {};
+
+    clock_gettime(CLOCK_MONOTONIC, &start_ts);
+    this->batch.clear();
+    auto dropped = elem->lost + elem->lost_samples;
+    auto r = collect(this->batch, elem);
+    dropped = elem->lost + elem->lost_samples - dropped;
+    clock_gettime(CLOCK_MONOTONIC, &decoded_ts);
+
+    // the drops are not told apart by event, both kinds of sample make up for them alike
+    auto scale = loss_scale(this->batch.size(), dropped);
+    this->batch.weight = weight() * scale;
+    this->batch.store_weight = store_weight() * scale;
+    controller->insert_batch(this->batch);
+    elem->total += this->batch.size();
+    clock_gettime(CLOCK_MONOTONIC, &end_ts);
+    this->decode_ns = (decoded_ts.tv_sec - start_ts.tv_sec) * 1000000000 + (decoded_ts.tv_nsec - start_ts.tv_nsec);
+    this->ingest_ns = (end_ts.tv_sec - decoded_ts.tv_sec) * 1000000000 + (end_ts.tv_nsec - decoded_ts.tv_nsec);
+
+    return r;
+}
+int PEBS::collect(SampleBatch &out, struct PEBSElem *elem) {
+    if (this->fd < 0 || mp == MAP_FAILED) {
+        return 0;
+    }
+    if (!this->queue) {
+        return decode(out, elem);
+    }
+    // only what is queued now, so a busy producer cannot hold the epoch
+    Sample sample{};
+    auto n = this->queue->size();
+    auto first = out.size();
+    for (size_t i = 0; i < n && this->queue->try_pop(sample); i++) {
+        out.push_back(sample);
+    }
+    elem->lost += this->drain_lost.exchange(0);
+    elem->lost_samples += this->drain_lost_samples.exchange(0);
+    if (out.size() != first) {
+        elem->llcmiss = this->drain_llcmiss.load(std::memory_order_relaxed);
+    }
+    return 0;
+}
+int PEBS::decode(SampleBatch &out, struct PEBSElem *elem) {
     int r = 0;
-    struct perf_event_header *header;
     struct perf_sample *data;
-    uint64_t last_head;
     char *dp = ((char *)mp) + PAGE_SIZE;
 
-    do {
-        this->seq = mp->lock; // explicit copy
-        barrier();
-        last_head = mp->data_head;
-        while ((uint64_t)this->rdlen < last_head) {
-            header = (struct perf_event_header *)(dp + this->rdlen % DATA_SIZE);
+    uint64_t records = 0, store_records = 0, throttles = 0;
+    uint8_t type;
+    std::shared_lock<std::shared_mutex> lock;
+    if (this->filter != nullptr) {
+        lock = std::shared_lock(this->filter->mutex);
+    }
 
-            switch (header->type) {
-            case PERF_RECORD_LOST:
-                LOG(DEBUG) << fmt::format("received PERF_RECORD_LOST\n");
-                break;
-            case PERF_RECORD_SAMPLE:
-                data = (struct perf_sample *)(dp + this->rdlen % DATA_SIZE);
+    auto last_head = mp->data_head;
+    barrier(); // the records are read only after data_head
+    while ((uint64_t)this->rdlen < last_head) {
+        auto offset = this->rdlen & (this->data_size - 1);
+        // records are 8 byte aligned, so the header itself never wraps
+        auto header = (struct perf_event_header *)(dp + offset);
+        auto size = header->size;
+        if (size == 0) {
+            LOG(ERROR) << "zero sized record, dropping the rest of the ring\n";
+            this->rdlen = last_head;
+            r = -1;
+            break;
+        }
+        auto record = dp + offset;
+        if (offset + size > this->data_size) {
+            auto first = this->data_size - offset;
+            memcpy(this->scratch.data(), dp + offset, first);
+            memcpy(this->scratch.data() + first, dp, size - first);
+            record = this->scratch.data();
+        }
 
-                if (header->size < sizeof(*data)) {
-                    LOG(DEBUG) << fmt::format("size too small. size:{}\n", header->size);
-                    r = -1;
-                    continue;
-                }
-                if (this->pid == data->pid) {
-                    LOG(ERROR) << fmt::format("pid:{} tid:{} time:{} addr:{} phys_addr:{} llc_miss:{} timestamp={}\n",
-                                              data->pid, data->tid, data->time_enabled, data->addr, data->phys_addr,
-                                              data->value, data->timestamp);
-                    controller->insert(data->timestamp, data->phys_addr, data->addr, 0);
-                    elem->total++;
+        switch (header->type) {
+        case PERF_RECORD_LOST:
+            elem->lost += ((struct perf_lost *)record)->lost;
+            break;
+        case PERF_RECORD_SAMPLE:
+            data = (struct perf_sample *)record;
+
+            if (size < sizeof(*data)) {
+                LOG(DEBUG) << fmt::format("size too small. size:{}\n", size);
+                records++;
+                r = -1;
+                break;
+            }
+            type = data->id == this->store_id ? ACCESS_STORE : ACCESS_LOAD;
+            type == ACCESS_STORE ? store_records++ : records++;
+            if (this->store_fd == -1) {
+                type = ACCESS_UNKNOWN;
+            }
+            if (this->filter != nullptr ? this->filter->contains(data->pid, data->tid) : this->pid == data->pid) {
+                out.push_back(data->timestamp, data->addr, data->phys_addr, data->tid, type);
+                if (type != ACCESS_STORE) {
                     elem->llcmiss = data->value; // this is the number of llc miss
                 }
-                break;
-            case PERF_RECORD_THROTTLE:
-                LOG(DEBUG) << "received PERF_RECORD_THROTTLE\n";
-                break;
-            case PERF_RECORD_UNTHROTTLE:
-                LOG(DEBUG) << "received PERF_RECORD_UNTHROTTLE\n";
-                break;
-            case PERF_RECORD_LOST_SAMPLES:
-                LOG(DEBUG) << "received PERF_RECORD_LOST_SAMPLES\n";
-                break;
-            default:
-                LOG(DEBUG) << fmt::format("other data received. type:{}\n", header->type);
-                break;
             }
-
-            this->rdlen += header->size;
+            break;
+        case PERF_RECORD_THROTTLE:
+            LOG(DEBUG) << "received PERF_RECORD_THROTTLE\n";
+            throttles++;
+            break;
+        case PERF_RECORD_UNTHROTTLE:
+            LOG(DEBUG) << "received PERF_RECORD_UNTHROTTLE\n";
+            break;
+        case PERF_RECORD_LOST_SAMPLES:
+            elem->lost_samples += ((struct perf_lost_samples *)record)->lost;
+            break;
+        default:
+            LOG(DEBUG) << fmt::format("other data received. type:{}\n", header->type);
+            break;
         }
 
-        mp->data_tail = last_head;
-        barrier();
-    } while (mp->lock != this->seq);
-    
+        this->rdlen += size;
+    }
+
+    barrier(); // finish reading before handing the space back
+    mp->data_tail = this->rdlen;
+    this->records.fetch_add(records, std::memory_order_relaxed);
+    this->store_records.fetch_add(store_records, std::memory_order_relaxed);
+    this->throttles.fetch_add(throttles, std::memory_order_relaxed);
+
     return r;
 }
+void PEBS::start_drain(int cpu, size_t queue_size) {
+    if (this->fd < 0 || this->draining.load()) {
+        return;
+    }
+    this->queue = std::make_unique<SPSCQueue<Sample>>(queue_size);
+    this->draining.store(true, std::memory_order_release);
+    this->drain_thread = std::thread(&PEBS::drain, this, cpu);
+}
+void PEBS::stop_drain() {
+    if (this->draining.exchange(false) && this->drain_thread.joinable()) {
+        this->drain_thread.join();
+    }
+}
+void PEBS::drain(int cpu) {
+    if (cpu >= 0) {
+        cpu_set_t cpuset;
+        CPU_ZERO(&cpuset);
+        CPU_SET(cpu, &cpuset);
+        if (pthread_setaffinity_np(pthread_self(), sizeof(cpuset), &cpuset) != 0) {
+            LOG(ERROR) << fmt::format("Failed to pin the drain thread to cpu {}\n", cpu);
+        }
+    }
+    SampleBatch local;
+    struct pollfd pfd = {.fd = this->fd, .events = POLLIN, .revents = 0};
+    struct timespec now {};
+    while (this->draining.load(std::memory_order_acquire)) {
+        poll(&pfd, 1, 10); // the watermark wakeup, or a 10ms tick to notice stop_drain
+        PEBSElem counts{};
+        local.clear();
+        decode(local, &counts);
+        for (size_t i = 0; i < local.size(); i++) {
+            if (!this->queue->try_push(
+                    {local.timestamp[i], local.virt_addr[i], local.phys_addr[i], local.tid[i], local.type[i]})) {
+                this->drain_overflow.fetch_add(1, std::memory_order_relaxed);
+            }
+        }
+        this->drain_lost.fetch_add(counts.lost, std::memory_order_relaxed);
+        this->drain_lost_samples.fetch_add(counts.lost_samples, std::memory_order_relaxed);
+        if (local.empty()) {
+            continue;
+        }
+        this->drain_llcmiss.store(counts.llcmiss, std::memory_order_relaxed);
+        auto depth = (uint64_t)this->queue->size();
+        if (depth > this->drain_high_water.load(std::memory_order_relaxed)) {
+            this->drain_high_water.store(depth, std::memory_order_relaxed);
+        }
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        auto now_ns = (uint64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+        auto latency = now_ns > local.timestamp[0] ? now_ns - local.timestamp[0] : 0;
+        auto worst = this->drain_latency_ns.load(std::memory_order_relaxed);
+        while (latency > worst && !this->drain_latency_ns.compare_exchange_weak(worst, latency)) {
+        }
+    }
+}
+int PEBS::set_period(uint64_t period, uint64_t store_period_) {
+    if (this->fd < 0) {
+        return 0;
+    }
+    if (ioctl(this->fd, PERF_EVENT_IOC_PERIOD, &period) < 0 ||
+        (this->store_fd != -1 && ioctl(this->store_fd, PERF_EVENT_IOC_PERIOD, &store_period_) < 0)) {
+        perror("ioctl");
+        return -1;
+    }
+    this->sample_period = period;
+    this->store_period = store_period_;
+    return 0;
+}
+uint64_t PEBS::next_period(uint64_t period, uint64_t records, uint64_t budget, bool throttled) {
+    if (budget == 0) {
+        return period;
+    }
+    // within 10% of the budget is close enough, so a steady phase does not retune every epoch
+    auto factor = records == 0 ? 0.5 : (double)records / (double)budget;
+    if (factor > 0.9 && factor < 1.1) {
+        factor = 1;
+    }
+    factor = std::clamp(factor, 0.5, 2.);
+    if (throttled) {
+        factor = 2;
+    }
+    return std::clamp((uint64_t)std::llround((double)period * factor), min_period, max_period);
+}
+uint64_t PEBS::adapt_period(uint64_t budget) {
+    auto records = this->records.exchange(0);
+    auto store_records = this->store_records.exchange(0);
+    auto throttled = this->throttles.exchange(0) != 0;
+    auto period = next_period(this->sample_period, records, budget, throttled);
+    // without a store event there are no store records to steer by
+    auto store_period_ = this->store_fd != -1 ? next_period(this->store_period, store_records, budget, throttled)
+                                              : this->store_period;
+    if (period != this->sample_period || store_period_ != this->store_period) {
+        set_period(period, store_period_);
+    }
+    return this->sample_period;
+}
 int PEBS::start() {
     if (this->fd < 0) {
         return 0;
     }
-    if (ioctl(this->fd, PERF_EVENT_IOC_ENABLE, 0) < 0) {
+    if (ioctl(this->fd, PERF_EVENT_IOC_ENABLE, 0) < 0 ||
+        (this->store_fd != -1 && ioctl(this->store_fd, PERF_EVENT_IOC_ENABLE, 0) < 0)) {
         perror("ioctl");
         return -1;
     }
@@ -139,13 +340,15 @@ int PEBS::stop() {
     if (this->fd < 0) {
         return 0;
     }
-    if (ioctl(this->fd, PERF_EVENT_IOC_DISABLE, 0) < 0) {
+    if (ioctl(this->fd, PERF_EVENT_IOC_DISABLE, 0) < 0 ||
+        (this->store_fd != -1 && ioctl(this->store_fd, PERF_EVENT_IOC_DISABLE, 0) < 0)) {
         perror("ioctl");
         return -1;
     }
     return 0;
 }
 PEBS::~PEBS() {
+    this->stop_drain();
     this->stop();
 
     if (this->fd < 0) {
@@ -158,6 +361,10 @@ PEBS::~PEBS() {
         this->mplen = 0;
     }
 
+    if (this->store_fd != -1) {
+        close(this->store_fd);
+        this->store_fd = -1;
+    }
     if (this->fd != -1) {
         close(this->fd);
         this->fd = -1;
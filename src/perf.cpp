@@ -32,42 +32,61 @@ ssize_t PerfInfo::read_pmu(uint64_t *value) {
     }
     return r;
 }
+ssize_t PerfInfo::read_group(uint64_t *values, size_t n) {
+    // nr, time_enabled, time_running, then the values
+    uint64_t buf[3 + max_group];
+    ssize_t r = read(this->fd, buf, sizeof(buf));
+    if (r < 0) {
+        LOG(ERROR) << "read\n";
+        return r;
+    }
+    auto nr = std::min<uint64_t>(buf[0], n);
+    auto enabled = buf[1], running = buf[2];
+    for (uint64_t i = 0; i < nr; i++) {
+        values[i] = running != 0 && running < enabled
+                        ? (uint64_t)((long double)buf[3 + i] * enabled / running)
+                        : buf[3 + i];
+    }
+    return r;
+}
 int PerfInfo::start() {
-    if (ioctl(this->fd, PERF_EVENT_IOC_ENABLE, 0) < 0) {
+    if (ioctl(this->fd, PERF_EVENT_IOC_ENABLE, this->attr.read_format & PERF_FORMAT_GROUP ? PERF_IOC_FLAG_GROUP : 0) <
+        0) {
         LOG(ERROR) << "ioctl\n";
         return -1;
     }
     return 0;
 }
 int PerfInfo::stop() {
-    if (ioctl(this->fd, PERF_EVENT_IOC_DISABLE, 0) < 0) {
+    if (ioctl(this->fd, PERF_EVENT_IOC_DISABLE, this->attr.read_format & PERF_FORMAT_GROUP ? PERF_IOC_FLAG_GROUP : 0) <
+        0) {
         LOG(ERROR) << "ioctl\n";
         return -1;
     }
     return 0;
 }
 
-PerfInfo *init_incore_perf(const pid_t pid, const int cpu, uint64_t conf, uint64_t conf1) {
-    int n_pid, n_cpu, group_fd, flags;
+PerfInfo *init_incore_perf(const pid_t pid, const int cpu, uint64_t conf, uint64_t conf1, int group_fd) {
+    int n_pid, n_cpu, flags;
     struct perf_event_attr attr {
-        .type = PERF_TYPE_RAW, .size = sizeof(attr), .config = conf, .disabled = 1, .inherit = 1, .config1 = conf1,
+        .type = PERF_TYPE_RAW, .size = sizeof(attr), .config = conf,
+        .read_format = group_fd == -1 ? PerfInfo::group_format : 0, .disabled = 1, .inherit = 1, .config1 = conf1,
         .clockid = 0
     };
     n_pid = -1;
     n_cpu = cpu;
 
-    group_fd = -1;
     flags = 0x08;
 
     return new PerfInfo{group_fd, n_cpu, n_pid, static_cast<unsigned long>(flags), attr};
 }
 
-PerfInfo *init_uncore_perf(const pid_t pid, const int cpu, uint64_t conf, uint64_t conf1, int value) {
-    int group_fd = -1;
+PerfInfo *init_uncore_perf(const pid_t pid, const int cpu, uint64_t conf, uint64_t conf1, int value, int group_fd) {
     auto attr = perf_event_attr{
         .type = (uint32_t)value,
         .size = sizeof(struct perf_event_attr),
         .config = conf,
+        .read_format = group_fd == -1 ? PerfInfo::group_format : 0,
         .disabled = 1,
         .inherit = 1,
         .enable_on_exec = 1,
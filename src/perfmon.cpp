@@ -0,0 +1,218 @@
+#include "perfmon.h"
+#include "logging.h"
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <nlohmann/json.hpp>
+#include <sstream>
+
+static std::string upper(std::string s) {
+    std::ranges::transform(s, s.begin(), [](unsigned char c) { return (char)std::toupper(c); });
+    return s;
+}
+
+/** perfmon writes numbers as "0x20" strings in most files and as plain numbers in a few */
+static uint64_t field(const nlohmann::json &event, const char *key) {
+    auto it = event.find(key);
+    if (it == event.end()) {
+        return 0;
+    }
+    if (it->is_number_unsigned()) {
+        return it->get<uint64_t>();
+    }
+    if (!it->is_string()) {
+        return 0;
+    }
+    try {
+        return std::stoull(it->get<std::string>(), nullptr, 0); // "0xB7,0xBB" stops at the comma
+    } catch (const std::exception &) {
+        return 0;
+    }
+}
+
+/** the PERFEVTSEL layout raw perf events take, with the Sapphire Rapids uncore umask extension from bit 32 */
+static PerfmonEvent encode(const nlohmann::json &event, bool uncore) {
+    uint64_t config = (field(event, "EventCode") & 0xff) | (field(event, "UMask") & 0xff) << 8 |
+                      (field(event, "EdgeDetect") & 1) << 18 | (field(event, "AnyThread") & 1) << 21 |
+                      (field(event, "Invert") & 1) << 23 | (field(event, "CounterMask") & 0xff) << 24 |
+                      field(event, "UMaskExt") << 32;
+    // offcore response and load latency events take the value of their extra MSR through config1
+    auto config1 = field(event, "MSRIndex") != 0 ? field(event, "MSRValue") : 0;
+    return {config, config1, uncore || event.contains("Unit")};
+}
+
+std::vector<std::filesystem::path> PerfmonCatalog::files(const std::filesystem::path &dir, uint32_t model) {
+    std::vector<std::filesystem::path> found;
+    std::ifstream map(dir / "mapfile.csv");
+    if (map.is_open()) {
+        // Family-model,Version,Filename,EventType,... where Family-model reads like GenuineIntel-6-55-[01234]
+        for (std::string line; std::getline(map, line);) {
+            std::vector<std::string> column;
+            std::stringstream ss(line);
+            for (std::string c; std::getline(ss, c, ',');) {
+                column.push_back(c);
+            }
+            unsigned family, cpu_model;
+            if (column.size() < 4 ||
+                std::sscanf(column[0].c_str(), "GenuineIntel-%u-%x", &family, &cpu_model) != 2 || family != 6 ||
+                cpu_model != model) {
+                continue;
+            }
+            if (column[3] == "core" || column[3] == "hybridcore" || column[3] == "uncore") {
+                found.push_back(dir / std::filesystem::path(column[2]).relative_path());
+            }
+        }
+    } else {
+        std::error_code ec;
+        for (auto const &entry : std::filesystem::directory_iterator(dir, ec)) {
+            if (entry.path().extension() == ".json") {
+                found.push_back(entry.path());
+            }
+        }
+    }
+    // the mapfile lists a file once per stepping
+    std::ranges::sort(found);
+    found.erase(std::unique(found.begin(), found.end()), found.end());
+    return found;
+}
+
+uint64_t PerfmonCatalog::stamp(const std::vector<std::filesystem::path> &files, uint32_t model) {
+    uint64_t hash = 0xcbf29ce484222325;
+    auto mix = [&hash](const void *data, size_t size) {
+        for (size_t i = 0; i < size; i++) {
+            hash = (hash ^ ((const unsigned char *)data)[i]) * 0x100000001b3;
+        }
+    };
+    mix(&model, sizeof(model));
+    for (auto const &file : files) {
+        std::error_code ec;
+        auto name = file.string();
+        auto size = (uint64_t)std::filesystem::file_size(file, ec);
+        auto mtime = (int64_t)std::filesystem::last_write_time(file, ec).time_since_epoch().count();
+        mix(name.data(), name.size());
+        mix(&size, sizeof(size));
+        mix(&mtime, sizeof(mtime));
+    }
+    return hash;
+}
+
+void PerfmonCatalog::parse(const std::filesystem::path &file, bool uncore) {
+    std::ifstream in(file);
+    auto doc = nlohmann::json::parse(in, nullptr, false);
+    if (doc.is_discarded()) {
+        LOG(ERROR) << fmt::format("Failed to parse perfmon file {}\n", file.string());
+        return;
+    }
+    // the newer files wrap the event list with a Header
+    const auto &list = doc.is_object() && doc.contains("Events") ? doc.at("Events") : doc;
+    if (!list.is_array()) {
+        return;
+    }
+    for (auto const &event : list) {
+        auto name = event.find("EventName");
+        if (name != event.end() && name->is_string()) {
+            this->events.emplace(upper(name->get<std::string>()), encode(event, uncore));
+        }
+    }
+}
+
+/* cache layout: magic, model, stamp, count, then per event the name length, name, config, config1 and uncore */
+bool PerfmonCatalog::load_cache(const std::string &path, uint64_t stamp) {
+    std::ifstream in(path, std::ios::binary);
+    std::vector<char> buf((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+    size_t pos = 0;
+    auto take = [&](void *out, size_t size) {
+        if (pos + size > buf.size()) {
+            return false;
+        }
+        memcpy(out, buf.data() + pos, size);
+        pos += size;
+        return true;
+    };
+    char head[sizeof(magic)];
+    uint32_t cached_model, count;
+    uint64_t cached_stamp;
+    if (!take(head, sizeof(head)) || memcmp(head, magic, sizeof(magic)) != 0 ||
+        !take(&cached_model, sizeof(cached_model)) || !take(&cached_stamp, sizeof(cached_stamp)) ||
+        !take(&count, sizeof(count)) || cached_model != this->model || cached_stamp != stamp) {
+        return false;
+    }
+    std::unordered_map<std::string, PerfmonEvent> cached;
+    cached.reserve(count);
+    for (uint32_t i = 0; i < count; i++) {
+        uint16_t length;
+        PerfmonEvent event{};
+        uint8_t uncore;
+        if (!take(&length, sizeof(length)) || pos + length > buf.size()) {
+            return false;
+        }
+        std::string name(buf.data() + pos, length);
+        pos += length;
+        if (!take(&event.config, sizeof(event.config)) || !take(&event.config1, sizeof(event.config1)) ||
+            !take(&uncore, sizeof(uncore))) {
+            return false;
+        }
+        event.uncore = uncore != 0;
+        cached.emplace(std::move(name), event);
+    }
+    this->events.swap(cached);
+    return true;
+}
+
+bool PerfmonCatalog::save_cache(const std::string &path, uint64_t stamp) const {
+    std::ofstream out(path, std::ios::binary | std::ios::trunc);
+    auto count = (uint32_t)this->events.size();
+    out.write(magic, sizeof(magic));
+    out.write((const char *)&this->model, sizeof(this->model));
+    out.write((const char *)&stamp, sizeof(stamp));
+    out.write((const char *)&count, sizeof(count));
+    for (auto const &[name, event] : this->events) {
+        auto length = (uint16_t)name.size();
+        uint8_t uncore = event.uncore;
+        out.write((const char *)&length, sizeof(length));
+        out.write(name.data(), length);
+        out.write((const char *)&event.config, sizeof(event.config));
+        out.write((const char *)&event.config1, sizeof(event.config1));
+        out.write((const char *)&uncore, sizeof(uncore));
+    }
+    return out.good();
+}
+
+bool PerfmonCatalog::load(const std::string &dir, uint32_t model, std::string cache) {
+    this->model = model;
+    this->events.clear();
+    auto list = files(dir, model);
+    if (list.empty()) {
+        LOG(ERROR) << fmt::format("No perfmon event file for model {:#x} in {}\n", model, dir);
+        return false;
+    }
+    if (cache.empty()) {
+        cache = (std::filesystem::path(dir) / fmt::format(".cxlmemsim_{:x}.cache", model)).string();
+    }
+    auto key = stamp(list, model);
+    auto start = std::chrono::steady_clock::now();
+    this->from_cache = load_cache(cache, key);
+    if (!this->from_cache) {
+        for (auto const &file : list) {
+            parse(file, file.filename().string().find("uncore") != std::string::npos);
+        }
+        if (!save_cache(cache, key)) {
+            LOG(INFO) << fmt::format("Could not write the perfmon cache {}\n", cache);
+        }
+    }
+    auto end = std::chrono::steady_clock::now();
+    LOG(INFO) << fmt::format("perfmon: {} events for model {:#x} from {} in {}us\n", this->events.size(), model,
+                             this->from_cache ? "cache" : "json",
+                             std::chrono::duration_cast<std::chrono::microseconds>(end - start).count());
+    return !this->events.empty();
+}
+
+std::optional<PerfmonEvent> PerfmonCatalog::find(const std::string &name) const {
+    auto it = this->events.find(upper(name));
+    if (it == this->events.end()) {
+        return std::nullopt;
+    }
+    return it->second;
+}
@@ -9,22 +9,10 @@ AllocationPolicy::AllocationPolicy() = default;
 InterleavePolicy::InterleavePolicy() = default;
 // If the number is -1 for local, else it is the index of the remote server
 int InterleavePolicy::compute_once(CXLController *controller) {
-    int per_size;
-    switch (controller->page_type_) {
-    case CACHELINE:
-        per_size = 64;
-        break;
-    case PAGE:
-        per_size = 4096;
-        break;
-    case HUGEPAGE_2M:
-        per_size = 2 * 1024 * 1024;
-        break;
-    case HUGEPAGE_1G:
-        per_size = 1024 * 1024 * 1024;
-        break;
-    };
-    if (controller->occupation.size() * per_size / 1024 / 1024 < controller->capacity * 0.9) {
+    auto per_size = page_type_size(controller->page_type_); // every occupation record covers one unit
+    // the capacities are in GB
+    auto used = [per_size](size_t entries) { return (double)(entries * per_size) / 1024 / 1024 / 1024; };
+    if (used(controller->occupation.size()) < controller->capacity * 0.9) {
         return -1;
     } else {
         if (this->percentage.empty()) {
@@ -38,21 +26,21 @@ int InterleavePolicy::compute_once(CXLController *controller) {
             }
             this->all_size = std::accumulate(this->percentage.begin(), this->percentage.end(), 0);
         }
-    next:
-        last_remote = (last_remote + 1) % all_size;
-        int sum, index;
-        for (index = 0, sum = 0; sum <= last_remote; index++) { // 5 2 2 to get the next
-            sum += this->percentage[index];
-            if (sum > last_remote) {
-                if (controller->cur_expanders[index]->occupation.size() * per_size / 1024 / 1024 <
-                    controller->cur_expanders[index]->capacity) {
+        // one round over the shares at most, when every expander is full the unit stays local
+        for (int tries = 0; tries < all_size; tries++) {
+            last_remote = (last_remote + 1) % all_size;
+            int sum, index;
+            for (index = 0, sum = 0; sum <= last_remote; index++) { // 5 2 2 to get the next
+                sum += this->percentage[index];
+                if (sum > last_remote) {
                     break;
-                } else {
-                    /** TODO: capacity bound */
-                    goto next;
                 }
             }
+            auto expander = controller->cur_expanders[index];
+            if (used(expander->occupation.size()) < expander->capacity) {
+                return index;
+            }
         }
-        return index;
+        return -1;
     }
 }
@@ -0,0 +1,129 @@
+/** Replay a trace recorded with CXLMemSim --record through another controller configuration, no PMU needed */
+#include "helper.h"
+#include "policy.h"
+#include "replay.h"
+#include <chrono>
+#include <cxxopts.hpp>
+#include <fstream>
+#include <sstream>
+#include <thread>
+
+Helper helper{};
+
+static ControllerConfig config_of(const cxxopts::ParseResult &result, const TraceHeader *header) {
+    auto config = ControllerConfig::from(result);
+    if (config.interval == 0) {
+        config.interval = (int)header->interval;
+    }
+    return config;
+}
+
+/** every line of the file is one configuration in the model options, the options it leaves out take their default */
+static int run_sweep(cxxopts::Options &options, const TraceReader &trace, const std::string &file, int threads) {
+    std::ifstream in(file);
+    if (!in.is_open()) {
+        LOG(ERROR) << fmt::format("Failed to open sweep file {}\n", file);
+        return 1;
+    }
+    std::vector<SweepPoint> points;
+    std::vector<std::string> rejected; // lines whose options do not parse, reported with the table
+    for (std::string line; std::getline(in, line);) {
+        std::vector<std::string> args{"CXLMemSimReplay"};
+        std::stringstream ss(line);
+        for (std::string arg; ss >> arg;) {
+            args.push_back(arg);
+        }
+        if (args.size() == 1 || args[1][0] == '#') {
+            continue;
+        }
+        std::vector<char *> argv;
+        for (auto &arg : args) {
+            argv.push_back(arg.data());
+        }
+        auto argc = (int)argv.size();
+        auto *argp = argv.data();
+        try {
+            auto result = options.parse(argc, argp);
+            points.push_back({config_of(result, trace.header), result["dramlatency"].as<double>(), line});
+        } catch (const std::exception &e) {
+            LOG(ERROR) << fmt::format("sweep line {}: {}\n", line, e.what());
+            rejected.push_back(line);
+        }
+    }
+    LOG(INFO) << fmt::format("sweep: {} configurations on {} threads\n", points.size(), threads);
+
+    auto start = std::chrono::steady_clock::now();
+    auto results = sweep(trace, points, threads);
+    auto wall = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    double samples = 0;
+    std::cout << fmt::format("{:>6} {:>16} {:>12} {:>10}  {}\n", "point", "delay ns", "samples", "replay s",
+                             "configuration");
+    for (auto const &[i, r] : results | enumerate) {
+        if (!r.ok) {
+            std::cout << fmt::format("{:>6} {:>16} {:>12} {:>10}  {}\n", i, "failed", "-", "-", points[i].label);
+            continue;
+        }
+        samples += (double)r.samples;
+        std::cout << fmt::format("{:>6} {:>16} {:>12} {:>10.3f}  {}\n", i, r.delay, r.samples,
+                                 (double)r.elapsed_ns / 1e9, points[i].label);
+    }
+    for (auto const &line : rejected) {
+        std::cout << fmt::format("{:>6} {:>16} {:>12} {:>10}  {}\n", "-", "failed", "-", "-", line);
+    }
+    // compare with -j 1 for the scaling
+    std::cout << fmt::format("swept {} configurations on {} threads in {:.3f}s, {:.0f} samples/sec\n", points.size(),
+                             threads, wall, samples / wall);
+    return 0;
+}
+int main(int argc, char *argv[]) {
+    cxxopts::Options options("CXLMemSimReplay", "Replay a recorded CXLMemSim trace through the model offline");
+    options.add_options()("t,trace", "The trace recorded with --record",
+                          cxxopts::value<std::string>()->default_value("cxlmemsim.trace"))(
+        "h,help", "Help for CXLMemSimReplay", cxxopts::value<bool>()->default_value("false"))(
+        "i,interval", "The epoch in ms, 0 takes the recorded one", cxxopts::value<int>()->default_value("0"))(
+        "q,quiet", "Only print the overall result", cxxopts::value<bool>()->default_value("false"))(
+        "from", "Start at this recorded epoch", cxxopts::value<uint64_t>()->default_value("0"))(
+        "sweep", "Replay every configuration listed in this file, one per line, and print them as one table",
+        cxxopts::value<std::string>()->default_value(""))(
+        "j,threads", "The sweep threads, 0 for one per cpu", cxxopts::value<int>()->default_value("0"));
+    add_model_options(options);
+
+    auto result = options.parse(argc, argv);
+    if (result["help"].as<bool>()) {
+        std::cout << options.help() << std::endl;
+        exit(0);
+    }
+    TraceReader trace(result["trace"].as<std::string>());
+    if (!trace.ok()) {
+        return 1;
+    }
+    if (!result["sweep"].as<std::string>().empty()) {
+        auto threads = result["threads"].as<int>();
+        return run_sweep(options, trace, result["sweep"].as<std::string>(),
+                         threads > 0 ? threads : (int)std::max(1U, std::thread::hardware_concurrency()));
+    }
+    auto config = config_of(result, trace.header);
+    auto *policy = new InterleavePolicy();
+    auto *controller = config.build(policy);
+    LOG(INFO) << controller->output() << "\n";
+
+    auto replayed = replay(trace, controller, result["dramlatency"].as<double>(), result["from"].as<uint64_t>());
+    if (!replayed.ok) {
+        LOG(ERROR) << fmt::format("{} has a corrupt sample record, replay stopped\n",
+                                  result["trace"].as<std::string>());
+        return 1;
+    }
+    if (!result["quiet"].as<bool>()) {
+        std::cout << fmt::format("{:>10} {:>12} {:>16}\n", "epoch", "samples", "delay ns");
+        for (auto const &e : replayed.epochs) {
+            std::cout << fmt::format("{:>10} {:>12} {:>16}\n", e.epoch, e.samples, e.delay);
+        }
+    }
+    std::cout << fmt::format("replayed {} epochs, {} samples: delay {}ns ({:.3f}s of {:.3f}s recorded), {:.0f} "
+                             "samples/sec\n",
+                             replayed.epochs.size(), replayed.samples, replayed.delay, (double)replayed.delay / 1e9,
+                             (double)replayed.epochs.size() * config.interval / 1e3,
+                             (double)replayed.samples * 1e9 / (double)(replayed.elapsed_ns + 1));
+    return 0;
+}
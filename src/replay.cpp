@@ -0,0 +1,91 @@
+#include "replay.h"
+#include "policy.h"
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <memory>
+#include <thread>
+
+uint64_t epoch_delay(CXLController *controller, double dramlatency, uint64_t readonly, uint64_t writeback,
+                     uint64_t read_config) {
+    auto all_access = controller->get_all_access();
+    LatencyPass lat_pass = {
+        .all_access = all_access,
+        .dramlatency = dramlatency,
+        .readonly = readonly,
+        .writeback = writeback,
+    };
+    BandwidthPass bw_pass = {
+        .all_access = all_access,
+        .read_config = read_config,
+        .write_config = read_config,
+    };
+    uint64_t delay = 0;
+    delay += std::lround(controller->calculate_latency(lat_pass));
+    delay += controller->calculate_bandwidth(bw_pass);
+    delay += std::get<0>(controller->calculate_congestion());
+    delay += std::lround(controller->calculate_queueing(lat_pass, bw_pass));
+    return delay;
+}
+
+ReplayResult replay(const TraceReader &trace, CXLController *controller, double dramlatency, uint64_t from_epoch) {
+    ReplayResult result;
+    ReplayEpoch current{};
+    SampleBatch batch;
+    auto start = std::chrono::steady_clock::now();
+    auto offset = from_epoch != 0 ? trace.seek(from_epoch) : trace.begin();
+    while (auto *record = trace.next(offset)) {
+        if (record->kind == TRACE_SAMPLES || record->kind == TRACE_BLOCK) {
+            // a monitor is charged once all of its blocks for the epoch are in; since version 3 the samples of the
+            // per cpu rings are only inserted, every monitor has a record of its own for the charge
+            auto last = trace.samples(record, batch);
+            if (last < 0) {
+                return result;
+            }
+            controller->insert_batch(batch);
+            current.samples += batch.size();
+            if (last == 1 && (TraceReader::monitor(record) != TRACE_CPU_WIDE || trace.header->version < 3)) {
+                current.delay += epoch_delay(controller, dramlatency);
+                current.charges++;
+            }
+        } else if (record->kind == TRACE_EPOCH) {
+            current.epoch = ((const TraceEpoch *)TraceReader::payload(record))->epoch;
+            controller->age_out();
+            result.samples += current.samples;
+            result.delay += current.delay;
+            result.epochs.push_back(current);
+            current = {};
+        }
+        // unknown kinds come from a newer writer and are skipped
+    }
+    auto end = std::chrono::steady_clock::now();
+    result.elapsed_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count();
+    result.ok = true;
+    return result;
+}
+
+std::vector<ReplayResult> sweep(const TraceReader &trace, const std::vector<SweepPoint> &points, int threads) {
+    std::vector<ReplayResult> results(points.size());
+    std::atomic<size_t> next{0};
+    // the points are taken one at a time, so a slow configuration does not hold up a whole share of them
+    auto worker = [&]() {
+        for (size_t i; (i = next.fetch_add(1, std::memory_order_relaxed)) < points.size();) {
+            InterleavePolicy policy;
+            try {
+                std::unique_ptr<CXLController> controller(points[i].config.build(&policy));
+                results[i] = replay(trace, controller.get(), points[i].dramlatency);
+            } catch (const std::exception &e) {
+                LOG(ERROR) << fmt::format("sweep point {} ({}): {}\n", i, points[i].label, e.what());
+            }
+        }
+    };
+    std::vector<std::thread> pool;
+    for (int t = 1; t < threads && t < (int)points.size(); t++) {
+        pool.emplace_back(worker);
+    }
+    worker();
+    for (auto &t : pool) {
+        t.join();
+    }
+    return results;
+}
@@ -0,0 +1,419 @@
+#include "trace.h"
+#include "logging.h"
+#include <algorithm>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static uint64_t now_ns() {
+    struct timespec ts {};
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000UL + ts.tv_nsec;
+}
+
+static size_t padded(size_t size) { return (size + 7) & ~(size_t)7; }
+
+/* the heads up to version 3, without the store weight */
+struct TraceSamplesV3 {
+    uint64_t epoch;
+    uint32_t monitor;
+    uint32_t count;
+    double weight;
+};
+struct TraceBlockV3 {
+    uint64_t epoch;
+    uint32_t monitor;
+    uint32_t count;
+    double weight;
+    uint32_t flags;
+    uint32_t size[4];
+    uint32_t reserved;
+};
+
+/** the fixed part of the payload of a record of kind in a trace of version, 0 for the kinds without one */
+static size_t head_size(uint32_t kind, uint32_t version) {
+    switch (kind) {
+    case TRACE_SAMPLES:
+        return version < 4 ? sizeof(TraceSamplesV3) : sizeof(TraceSamples);
+    case TRACE_EPOCH:
+        return sizeof(TraceEpoch);
+    case TRACE_BLOCK:
+        return version < 4 ? sizeof(TraceBlockV3) : sizeof(TraceBlock);
+    }
+    return 0;
+}
+
+/* the deltas are taken modulo 2^64, zigzag keeps a small step back as short as a small step forward */
+static uint64_t zigzag(uint64_t delta) { return delta << 1 ^ (uint64_t)((int64_t)delta >> 63); }
+static uint64_t unzigzag(uint64_t value) { return value >> 1 ^ -(value & 1); }
+
+static uint8_t *put_varint(uint8_t *p, uint64_t value) {
+    while (value >= 0x80) {
+        *p++ = (uint8_t)value | 0x80;
+        value >>= 7;
+    }
+    *p++ = (uint8_t)value;
+    return p;
+}
+/** nullptr when the varint runs into end */
+static const uint8_t *get_varint(const uint8_t *p, const uint8_t *end, uint64_t &value) {
+    if (p == end) {
+        return nullptr;
+    }
+    uint64_t b = *p++;
+    value = b & 0x7f;
+    for (int shift = 7; b & 0x80 && shift < 64; shift += 7) {
+        if (p == end) {
+            return nullptr;
+        }
+        b = *p++;
+        value |= (b & 0x7f) << shift;
+    }
+    return p;
+}
+
+template <typename T> static uint8_t *put_column(uint8_t *p, const T *column, size_t n) {
+    uint64_t last = 0;
+    for (size_t i = 0; i < n; i++) {
+        p = put_varint(p, zigzag((uint64_t)column[i] - last));
+        last = column[i];
+    }
+    return p;
+}
+/** nullptr when the n varints run into end */
+template <typename T> static const uint8_t *get_column(const uint8_t *p, const uint8_t *end, T *column, size_t n) {
+    uint64_t last = 0, value;
+    for (size_t i = 0; i < n; i++) {
+        if ((p = get_varint(p, end, value)) == nullptr) {
+            return nullptr;
+        }
+        last += unzigzag(value);
+        column[i] = (T)last;
+    }
+    return p;
+}
+
+TraceWriter::TraceWriter(const std::string &path, uint32_t cpu_model, uint32_t interval, uint64_t period,
+                         bool direct, bool packed)
+    : direct(direct), packed(packed) {
+    this->open_ns = now_ns();
+    this->fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | (direct ? O_DIRECT : 0), 0644);
+    if (this->fd < 0 && direct) {
+        // tmpfs and some other filesystems refuse O_DIRECT
+        LOG(INFO) << fmt::format("O_DIRECT refused for {}, recording buffered\n", path);
+        this->direct = false;
+        this->fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    }
+    if (this->fd < 0) {
+        LOG(ERROR) << fmt::format("Failed to open trace {}: {}\n", path, strerror(errno));
+        return;
+    }
+    this->buf = (char *)aligned_alloc(block_size, buffer_size);
+    memcpy(this->header.magic, "CXLTRACE", sizeof(this->header.magic));
+    this->header.version = TRACE_VERSION;
+    this->header.header_size = sizeof(TraceHeader);
+    this->header.cpu_model = cpu_model;
+    this->header.interval = interval;
+    this->header.period = period;
+    append(&this->header, sizeof(this->header));
+}
+TraceWriter::~TraceWriter() {
+    close();
+    free(this->buf);
+}
+void TraceWriter::append(const void *data, size_t size) {
+    auto *src = (const char *)data;
+    while (size > 0 && this->fd >= 0) {
+        auto n = std::min(size, buffer_size - this->used);
+        memcpy(this->buf + this->used, src, n);
+        this->used += n;
+        this->bytes += n;
+        src += n;
+        size -= n;
+        if (this->used == buffer_size) {
+            flush(false);
+        }
+    }
+}
+void TraceWriter::pad() {
+    static constexpr uint64_t zero = 0;
+    append(&zero, padded(this->bytes) - this->bytes);
+}
+bool TraceWriter::flush(bool final) {
+    // with O_DIRECT the tail that is not a whole block waits for the next flush
+    auto n = final || !this->direct ? this->used : this->used / block_size * block_size;
+    if (final && this->direct) {
+        fcntl(this->fd, F_SETFL, fcntl(this->fd, F_GETFL) & ~O_DIRECT);
+    }
+    for (size_t done = 0; done < n;) {
+        auto r = write(this->fd, this->buf + done, n - done);
+        if (r < 0 && errno == EINTR) {
+            continue;
+        }
+        if (r <= 0) {
+            LOG(ERROR) << fmt::format("Failed to write the trace: {}, recording stopped\n", strerror(errno));
+            ::close(this->fd);
+            this->fd = -1;
+            return false;
+        }
+        done += r;
+    }
+    memmove(this->buf, this->buf + n, this->used - n);
+    this->used -= n;
+    return true;
+}
+void TraceWriter::samples(uint64_t epoch, uint32_t monitor, const SampleBatch &batch) {
+    if (this->fd < 0) {
+        return;
+    }
+    auto start = now_ns();
+    auto n = batch.size();
+    this->entries.push_back({this->bytes, epoch, n != 0 ? batch.timestamp[0] : 0});
+    this->header.samples += n;
+    if (this->packed) {
+        size_t first = 0;
+        do {
+            auto count = std::min(n - first, block_samples);
+            block(epoch, monitor, batch, first, count, first + count == n);
+            first += count;
+        } while (first < n);
+        this->write_ns += now_ns() - start;
+        return;
+    }
+    TraceSamples head{epoch, monitor, (uint32_t)n, batch.weight, batch.store_weight};
+    TraceRecord record{TRACE_SAMPLES, (uint32_t)(sizeof(head) + 3 * n * sizeof(uint64_t) +
+                                                 padded(n * sizeof(uint32_t)) + padded(n * sizeof(uint8_t)))};
+    append(&record, sizeof(record));
+    append(&head, sizeof(head));
+    append(batch.timestamp.data(), n * sizeof(uint64_t));
+    append(batch.virt_addr.data(), n * sizeof(uint64_t));
+    append(batch.phys_addr.data(), n * sizeof(uint64_t));
+    append(batch.tid.data(), n * sizeof(uint32_t));
+    pad();
+    append(batch.type.data(), n * sizeof(uint8_t));
+    pad();
+    this->header.records++;
+    this->write_ns += now_ns() - start;
+}
+void TraceWriter::block(uint64_t epoch, uint32_t monitor, const SampleBatch &batch, size_t first, size_t count,
+                        bool last) {
+    // a varint takes at most 10 bytes
+    this->scratch.resize(sizeof(TraceBlock) + 4 * 10 * count + (count + 3) / 4);
+    auto *head = (TraceBlock *)this->scratch.data();
+    *head = {epoch, monitor, (uint32_t)count, batch.weight, batch.store_weight, last ? TRACE_BLOCK_LAST : 0, {}, 0};
+    auto *p = this->scratch.data() + sizeof(TraceBlock);
+    auto *q = put_column(p, batch.timestamp.data() + first, count);
+    head->size[0] = q - p;
+    p = put_column(q, batch.virt_addr.data() + first, count);
+    head->size[1] = p - q;
+    q = put_column(p, batch.phys_addr.data() + first, count);
+    head->size[2] = q - p;
+    p = put_column(q, batch.tid.data() + first, count);
+    head->size[3] = p - q;
+    memset(p, 0, (count + 3) / 4);
+    for (size_t i = 0; i < count; i++) {
+        p[i / 4] |= (batch.type[first + i] & 3) << (i % 4 * 2);
+    }
+    p += (count + 3) / 4;
+    TraceRecord record{TRACE_BLOCK, (uint32_t)(p - this->scratch.data())};
+    append(&record, sizeof(record));
+    append(this->scratch.data(), record.size);
+    pad();
+    this->header.records++;
+}
+void TraceWriter::epoch(uint64_t epoch, const std::vector<CHAElem> &chas, const std::vector<CPUElem> &cpus) {
+    if (this->fd < 0) {
+        return;
+    }
+    auto start = now_ns();
+    TraceEpoch head{epoch, start, (uint32_t)chas.size(), (uint32_t)cpus.size()};
+    TraceRecord record{TRACE_EPOCH,
+                       (uint32_t)(sizeof(head) + chas.size() * sizeof(CHAElem) + cpus.size() * sizeof(CPUElem))};
+    append(&record, sizeof(record));
+    append(&head, sizeof(head));
+    append(chas.data(), chas.size() * sizeof(CHAElem));
+    append(cpus.data(), cpus.size() * sizeof(CPUElem));
+    this->header.epochs++;
+    this->header.records++;
+    this->write_ns += now_ns() - start;
+}
+void TraceWriter::close() {
+    if (this->fd < 0) {
+        return;
+    }
+    auto start = now_ns();
+    TraceRecord record{TRACE_INDEX, (uint32_t)(this->entries.size() * sizeof(TraceIndexEntry))};
+    this->header.index = this->bytes;
+    append(&record, sizeof(record));
+    append(this->entries.data(), record.size);
+    if (flush(true)) {
+        if (pwrite(this->fd, &this->header, sizeof(this->header), 0) != sizeof(this->header)) {
+            LOG(ERROR) << fmt::format("Failed to write the trace header: {}\n", strerror(errno));
+        }
+        ::close(this->fd);
+        this->fd = -1;
+    }
+    this->write_ns += now_ns() - start;
+    auto elapsed = now_ns() - this->open_ns;
+    LOG(INFO) << fmt::format("trace: {} epochs, {} samples, {} bytes, {}us writing, {:.3f}% of {}ms{}{}\n",
+                             this->header.epochs, this->header.samples, this->bytes, this->write_ns / 1000,
+                             100. * (double)this->write_ns / (double)(elapsed + 1), elapsed / 1000000,
+                             this->packed ? ", packed" : "", this->direct ? " with O_DIRECT" : "");
+}
+
+TraceReader::TraceReader(const std::string &path) {
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        LOG(ERROR) << fmt::format("Failed to open trace {}: {}\n", path, strerror(errno));
+        return;
+    }
+    struct stat st {};
+    fstat(fd, &st);
+    this->length = st.st_size;
+    if (this->length >= sizeof(TraceHeader)) {
+        auto *m = mmap(nullptr, this->length, PROT_READ, MAP_PRIVATE, fd, 0);
+        this->map = m == MAP_FAILED ? nullptr : (const char *)m;
+    }
+    ::close(fd);
+    if (this->map == nullptr) {
+        LOG(ERROR) << fmt::format("Failed to map trace {}\n", path);
+        return;
+    }
+    madvise((void *)this->map, this->length, MADV_SEQUENTIAL);
+    auto *h = (const TraceHeader *)this->map;
+    if (memcmp(h->magic, "CXLTRACE", sizeof(h->magic)) != 0 || h->version == 0 || h->version > TRACE_VERSION ||
+        h->header_size < sizeof(TraceHeader) || h->header_size > this->length) {
+        LOG(ERROR) << fmt::format("{} is not a trace of version {} or older\n", path, TRACE_VERSION);
+        return;
+    }
+    this->header = h;
+}
+TraceReader::~TraceReader() {
+    if (this->map != nullptr) {
+        munmap((void *)this->map, this->length);
+    }
+}
+const TraceRecord *TraceReader::next(size_t &offset) const {
+    if (this->header == nullptr || offset + sizeof(TraceRecord) > this->length) {
+        return nullptr;
+    }
+    auto *record = (const TraceRecord *)(this->map + offset);
+    auto end = offset + sizeof(TraceRecord) + padded(record->size);
+    if (end > this->length) {
+        return nullptr;
+    }
+    // unknown kinds are left to the caller to skip
+    auto head = head_size(record->kind, this->header->version);
+    if (record->size < head) {
+        LOG(ERROR) << fmt::format("trace record at {} is {} bytes, too short for its kind {}\n", offset,
+                                  record->size, record->kind);
+        return nullptr;
+    }
+    offset = end;
+    return record;
+}
+std::span<const TraceIndexEntry> TraceReader::index() const {
+    if (this->header == nullptr || this->header->version < 2 || this->header->index == 0) {
+        return {};
+    }
+    auto offset = (size_t)this->header->index;
+    auto *record = next(offset);
+    if (record == nullptr || record->kind != TRACE_INDEX) {
+        return {};
+    }
+    return {(const TraceIndexEntry *)payload(record), record->size / sizeof(TraceIndexEntry)};
+}
+size_t TraceReader::seek(uint64_t epoch) const {
+    auto entries = index();
+    if (!entries.empty()) {
+        auto it = std::ranges::lower_bound(entries, epoch, {}, &TraceIndexEntry::epoch);
+        return it != entries.end() ? it->offset : this->header->index;
+    }
+    // no index, walk up to the first record of epoch; every kind but the index starts with its epoch
+    auto offset = begin();
+    for (auto at = offset; auto *record = next(offset); at = offset) {
+        if (record->kind != TRACE_INDEX && *(const uint64_t *)payload(record) >= epoch) {
+            return at;
+        }
+    }
+    return offset;
+}
+int TraceReader::samples(const TraceRecord *record, SampleBatch &batch) const {
+    batch.clear();
+    auto version = this->header->version;
+    auto *data = (const char *)payload(record) + head_size(record->kind, version);
+    if (record->kind == TRACE_BLOCK) {
+        TraceBlock block;
+        if (version < 4) {
+            auto *old = (const TraceBlockV3 *)payload(record);
+            block = {old->epoch, old->monitor, old->count, old->weight, old->weight, old->flags, {}, 0};
+            memcpy(block.size, old->size, sizeof(block.size));
+        } else {
+            block = *(const TraceBlock *)payload(record);
+        }
+        auto *head = &block;
+        size_t n = head->count;
+        // every sample takes at least a byte of each column, so the sizes bound n before anything is allocated
+        uint64_t columns = 0;
+        auto fits = true;
+        for (auto size : head->size) {
+            columns += size;
+            fits &= size >= n;
+        }
+        if (!fits || head_size(TRACE_BLOCK, version) + columns + (n + 3) / 4 > record->size) {
+            LOG(ERROR) << fmt::format("trace block of {} samples does not fit its {} bytes\n", n, record->size);
+            return -1;
+        }
+        batch.timestamp.resize(n);
+        batch.virt_addr.resize(n);
+        batch.phys_addr.resize(n);
+        batch.tid.resize(n);
+        batch.type.resize(n);
+        auto *p = (const uint8_t *)data;
+        auto column = [&](auto *data, uint32_t size) {
+            // a column ends exactly where its size says
+            auto *end = p + size;
+            auto ok = get_column(p, end, data, n) == end;
+            p = end;
+            return ok;
+        };
+        if (!column(batch.timestamp.data(), head->size[0]) || !column(batch.virt_addr.data(), head->size[1]) ||
+            !column(batch.phys_addr.data(), head->size[2]) || !column(batch.tid.data(), head->size[3])) {
+            LOG(ERROR) << fmt::format("trace block of {} samples has a column that does not decode to its size\n", n);
+            batch.clear();
+            return -1;
+        }
+        for (size_t i = 0; i < n; i++) {
+            batch.type[i] = p[i / 4] >> (i % 4 * 2) & 3;
+        }
+        batch.weight = head->weight;
+        batch.store_weight = head->store_weight;
+        return (head->flags & TRACE_BLOCK_LAST) != 0;
+    }
+    // the two heads agree up to the weight
+    auto *head = (const TraceSamples *)payload(record);
+    uint64_t n = head->count;
+    if (head_size(TRACE_SAMPLES, version) + n * 3 * sizeof(uint64_t) + padded(n * sizeof(uint32_t)) + padded(n) >
+        record->size) {
+        LOG(ERROR) << fmt::format("trace sample record of {} samples does not fit its {} bytes\n", n, record->size);
+        return -1;
+    }
+    auto *timestamp = (const uint64_t *)data;
+    auto *virt_addr = timestamp + n;
+    auto *phys_addr = virt_addr + n;
+    auto *tid = (const uint32_t *)(phys_addr + n);
+    auto *type = (const uint8_t *)tid + padded(n * sizeof(uint32_t));
+    batch.timestamp.assign(timestamp, timestamp + n);
+    batch.virt_addr.assign(virt_addr, virt_addr + n);
+    batch.phys_addr.assign(phys_addr, phys_addr + n);
+    batch.tid.assign(tid, tid + n);
+    batch.type.assign(type, type + n);
+    batch.weight = head->weight;
+    batch.store_weight = version < 4 ? head->weight : head->store_weight;
+    return 1;
+}
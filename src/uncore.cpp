@@ -4,7 +4,7 @@
 
 #include "uncore.h"
 extern Helper helper;
-Uncore::Uncore(const uint32_t unc_idx, PerfConfig *perf_config) {
+Uncore::Uncore(const uint32_t unc_idx, const int cpu, PerfConfig *perf_config) : unc_idx(unc_idx) {
     unsigned long value;
     int r;
     char path[64], buf[32];
@@ -33,20 +33,22 @@ Uncore::Uncore(const uint32_t unc_idx, PerfConfig *perf_config) {
     }
 
     for (auto const &[k, v] : this->perf | enumerate) {
-        v = init_uncore_perf(-1, (int)unc_idx, std::get<1>(perf_config->cha[k]), std::get<2>(perf_config->cha[k]),
-                             value);
+        v = init_uncore_perf(-1, cpu, std::get<1>(perf_config->cha[k]), std::get<2>(perf_config->cha[k]), value,
+                             k == 0 ? -1 : this->perf[0]->fd);
     }
 }
 
+int Uncore::start() { return this->perf[0]->start(); }
+int Uncore::stop() { return this->perf[0]->stop(); }
+
 int Uncore::read_cha_elems(struct CHAElem *elem) {
-    ssize_t r;
-    for (auto const &[idx, value] : this->perf | enumerate) {
-        r = value->read_pmu(&elem->cha[idx]);
-        if (r < 0) {
-            LOG(ERROR) << fmt::format("read cha_elems[{}] failed.\n", std::get<0>(helper.perf_conf.cha[idx]));
-            return r;
-        }
-        LOG(DEBUG) << fmt::format("read cha_elems[{}]:{}\n", std::get<0>(helper.perf_conf.cha[idx]), elem->cha[idx]);
+    ssize_t r = this->perf[0]->read_group(elem->cha.data(), elem->cha.size());
+    if (r < 0) {
+        LOG(ERROR) << fmt::format("read cha_elems failed.\n");
+        return r;
+    }
+    for (auto const &[idx, value] : elem->cha | enumerate) {
+        LOG(DEBUG) << fmt::format("read cha_elems[{}]:{}\n", std::get<0>(helper.perf_conf.cha[idx]), value);
     }
 
     return 0;
@@ -0,0 +1,40 @@
+#ifndef CXLMEMSIM_CHECK_H
+#define CXLMEMSIM_CHECK_H
+
+#include "logging.h"
+#include <type_traits>
+#include <utility>
+
+/** Minimal assertions for the ctest targets: a failed check is reported and the test exits non zero at the end */
+inline int check_failures = 0;
+
+/** integers compare by value whatever their signedness, so a size_t checks against a plain literal */
+template <typename A, typename B> bool check_equal(const A &a, const B &b) {
+    if constexpr (std::is_integral_v<A> && std::is_integral_v<B> && !std::is_same_v<A, bool> &&
+                  !std::is_same_v<B, bool>) {
+        return std::cmp_equal(a, b);
+    } else {
+        return a == b;
+    }
+}
+
+#define CHECK(cond)                                                                                                    \
+    do {                                                                                                               \
+        if (!(cond)) {                                                                                                 \
+            std::cerr << fmt::format("{}:{}: CHECK({}) failed\n", __FILE__, __LINE__, #cond);                          \
+            check_failures++;                                                                                          \
+        }                                                                                                              \
+    } while (0)
+
+#define CHECK_EQ(a, b)                                                                                                 \
+    do {                                                                                                               \
+        auto check_a = (a);                                                                                            \
+        auto check_b = (b);                                                                                            \
+        if (!check_equal(check_a, check_b)) {                                                                          \
+            std::cerr << fmt::format("{}:{}: CHECK_EQ({}, {}) failed: {} != {}\n", __FILE__, __LINE__, #a, #b,         \
+                                     check_a, check_b);                                                                \
+            check_failures++;                                                                                          \
+        }                                                                                                              \
+    } while (0)
+
+#endif // CXLMEMSIM_CHECK_H
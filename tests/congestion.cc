@@ -0,0 +1,143 @@
+/** The streamed per switch congestion count against the sort based count it replaced, on a reference trace */
+#include "check.h"
+#include "cxlcontroller.h"
+#include "helper.h"
+#include "policy.h"
+#include <memory>
+
+Helper helper{};
+
+static constexpr uint64_t window = 2000; // 20ns, CXLSwitch::congestion_window
+
+static uint64_t xorshift(uint64_t &state) {
+    state ^= state << 13;
+    state ^= state >> 7;
+    state ^= state << 17;
+    return state;
+}
+
+/** adjacent pairs closer than the window */
+static uint64_t pairs(const std::vector<uint64_t> &arrivals) {
+    uint64_t conflicts = 0;
+    for (size_t i = 1; i < arrivals.size(); i++) {
+        auto gap = arrivals[i] > arrivals[i - 1] ? arrivals[i] - arrivals[i - 1] : arrivals[i - 1] - arrivals[i];
+        conflicts += gap < window;
+    }
+    return conflicts;
+}
+
+/** The count before the streaming model: every switch sorts the last touch of each occupied unit below it since
+ * the epoch began and counts the adjacent pairs, without the skip after each conflict of the old loop */
+static uint64_t sorted_reference(CXLController *controller, uint64_t since) {
+    auto &topology = controller->topology;
+    uint64_t conflicts = 0;
+    for (size_t s = 0; s < topology.num_switches(); s++) {
+        std::vector<uint64_t> touches;
+        for (auto leaf = topology.switch_first[s]; leaf < topology.switch_last[s]; leaf++) {
+            for (auto const &entry : topology.expander_node[leaf]->occupation) {
+                if (entry.last_touch >= since) {
+                    touches.push_back(entry.last_touch);
+                }
+            }
+        }
+        std::sort(touches.begin(), touches.end());
+        conflicts += pairs(touches);
+    }
+    return conflicts;
+}
+
+/** time ordered samples on distinct pages, gaps on both sides of the window */
+static SampleBatch reference_trace(uint64_t &timestamp, uint64_t &page, size_t n, uint64_t &state) {
+    static constexpr uint64_t gaps[] = {500, 1900, 2100, 8000};
+    SampleBatch batch;
+    for (size_t i = 0; i < n; i++) {
+        timestamp += gaps[xorshift(state) % 4];
+        auto addr = 0x100000000 + page++ * 4096;
+        batch.push_back(timestamp, addr, addr, 1, ACCESS_LOAD);
+    }
+    return batch;
+}
+
+static std::unique_ptr<CXLController> build(InterleavePolicy *policy) {
+    // nothing local and expanders that never fill, every sample goes through the switches
+    ControllerConfig config{
+        .capacity = {0, 1 << 20, 1 << 20, 1 << 20},
+        .latency = {100, 150, 100, 150, 100, 150},
+        .bandwidth = {50, 50, 50, 50, 50, 50},
+        .topology = "(1,(2,3))",
+    };
+    return std::unique_ptr<CXLController>(config.build(policy));
+}
+
+int main() {
+    uint64_t state = 0x9e3779b97f4a7c15, timestamp = 1000000, page = 0;
+
+    /* one time ordered stream of first touches: the streamed count is the sorted one, epoch by epoch. The epochs are
+     * a window apart, a pair across the boundary would be counted in the later epoch where the old model saw none */
+    {
+        InterleavePolicy policy;
+        auto controller = build(&policy);
+        for (int epoch = 0; epoch < 4; epoch++) {
+            timestamp += window;
+            auto since = timestamp + 1;
+            auto batch = reference_trace(timestamp, page, 50000, state);
+            controller->insert_batch(batch);
+            auto expected = sorted_reference(controller.get(), since);
+            CHECK(expected > 0);
+            CHECK_EQ(std::get<1>(controller->calculate_congestion()), expected);
+        }
+    }
+
+    /* two monitors whose epochs overlap in time arrive one batch after the other: each batch is counted along its
+     * own order and the seam between them is one more pair, nothing of the second batch is lost */
+    {
+        InterleavePolicy policy;
+        auto controller = build(&policy);
+        auto start = timestamp + 1;
+        auto a = reference_trace(timestamp, page, 20000, state);
+        timestamp = start;
+        auto b = reference_trace(timestamp, page, 20000, state);
+        controller->insert_batch(a);
+        controller->insert_batch(b);
+        auto &topology = controller->topology;
+        uint64_t expected = 0;
+        for (size_t s = 0; s < topology.num_switches(); s++) {
+            std::vector<uint64_t> arrivals;
+            for (auto const *batch : {&a, &b}) {
+                for (size_t i = 0; i < batch->size(); i++) {
+                    auto placed = controller->placement.at(controller->occupation.unit(batch->phys_addr[i]));
+                    if (placed == -1) {
+                        continue;
+                    }
+                    auto leaf = (uint32_t)topology.route[placed];
+                    if (leaf >= topology.switch_first[s] && leaf < topology.switch_last[s]) {
+                        arrivals.push_back(batch->timestamp[i]);
+                    }
+                }
+            }
+            expected += pairs(arrivals);
+        }
+        CHECK(expected > 0);
+        CHECK_EQ(std::get<1>(controller->calculate_congestion()), expected);
+    }
+
+    /* re-touches count as arrivals: every routed sample is one, while the old model saw one touch per unit */
+    {
+        InterleavePolicy policy;
+        auto controller = build(&policy);
+        SampleBatch batch;
+        for (uint64_t i = 0; i < 1000; i++) {
+            batch.push_back(1000000 + i * 1000, 0x100000000, 0x100000000, 1, ACCESS_LOAD);
+        }
+        controller->insert_batch(batch);
+        auto &topology = controller->topology;
+        uint64_t depth = 0; // the switches the unit's samples pass
+        auto leaf = topology.route[controller->placement.begin()->second];
+        for (auto s = topology.expander_parent[leaf]; s != -1; s = topology.switch_parent[s]) {
+            depth++;
+        }
+        CHECK_EQ(std::get<1>(controller->calculate_congestion()), 999 * depth);
+        CHECK_EQ(sorted_reference(controller.get(), 0), (uint64_t)0);
+    }
+    return check_failures != 0;
+}
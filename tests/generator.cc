@@ -0,0 +1,83 @@
+/** The generator is deterministic in its seed: the same stream and the same delay through the model on every run */
+#include "check.h"
+#include "generator.h"
+#include "helper.h"
+#include "policy.h"
+#include "replay.h"
+#include <memory>
+
+Helper helper{};
+
+static constexpr double dramlatency = 110;
+
+/** CXLMemSimGen's defaults, with -i 100. The streams below stay well inside the expanders */
+static ControllerConfig config() {
+    return {
+        .capacity = {0, 20, 20, 20},
+        .latency = {100, 150, 100, 150, 100, 150},
+        .bandwidth = {50, 50, 50, 50, 50, 50},
+        .topology = "(1,(2,3))",
+        .interval = 100,
+        .port_bandwidth = {0, 0},
+    };
+}
+
+/** the epoch loop of gen.cc, return the delay over the whole stream */
+static uint64_t run(const std::string &spec, uint64_t seed) {
+    InterleavePolicy policy;
+    auto cfg = config();
+    std::unique_ptr<CXLController> controller(cfg.build(&policy));
+    constexpr uint64_t rate = 1000000;
+    Generator generator(*Generator::parse(spec), rate, seed);
+    SampleBatch batch;
+    uint64_t delay = 0;
+    while (generator.next(batch, rate * cfg.interval / 1000)) {
+        controller->insert_batch(batch);
+        delay += epoch_delay(controller.get(), dramlatency);
+        controller->age_out();
+    }
+    return delay;
+}
+
+/** fold every column of the stream into one value */
+static uint64_t digest(const std::string &spec, uint64_t seed, uint64_t &samples) {
+    Generator generator(*Generator::parse(spec), 1000000, seed);
+    SampleBatch batch;
+    uint64_t hash = 0xcbf29ce484222325;
+    auto mix = [&](uint64_t v) { hash = (hash ^ v) * 0x100000001b3; };
+    samples = 0;
+    while (generator.next(batch, 4096)) {
+        for (size_t i = 0; i < batch.size(); i++) {
+            mix(batch.timestamp[i]);
+            mix(batch.virt_addr[i]);
+            mix(batch.phys_addr[i]);
+            mix(batch.type[i]);
+        }
+        samples += batch.size();
+    }
+    return hash;
+}
+
+int main() {
+    const std::string mixed = "ld,n=200K,f=16M;zipf,n=200K,f=16M,w=0.3;uniform,n=100K,f=8M;chase,n=100K,f=4M";
+    constexpr uint64_t seed = 0xdeadbeef1245678;
+
+    // the stream itself
+    uint64_t samples_a, samples_b, samples_c;
+    auto a = digest(mixed, seed, samples_a);
+    auto b = digest(mixed, seed, samples_b);
+    auto c = digest(mixed, seed ^ 1, samples_c);
+    CHECK_EQ(samples_a, 614400);
+    CHECK_EQ(a, b);
+    CHECK_EQ(samples_a, samples_b);
+    CHECK(a != c);
+    CHECK_EQ(samples_c, 614400);
+
+    // and the delay it charges, pinned so a change to the generator or the model shows up here
+    CHECK_EQ(run("ld,f=16M", seed), 33257);
+    auto mixed_delay = run(mixed, seed);
+    CHECK_EQ(run(mixed, seed), mixed_delay);
+    CHECK_EQ(mixed_delay, 18451);
+
+    return check_failures != 0;
+}
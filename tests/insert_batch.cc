@@ -0,0 +1,98 @@
+/** insert_batch against sample by sample insert on one trace: the same placement, occupation and delay */
+#include "check.h"
+#include "cxlcontroller.h"
+#include "helper.h"
+#include "policy.h"
+#include "replay.h"
+#include <memory>
+
+Helper helper{};
+
+static uint64_t xorshift(uint64_t &state) {
+    state ^= state << 13;
+    state ^= state >> 7;
+    state ^= state << 17;
+    return state;
+}
+
+static std::unique_ptr<CXLController> build(InterleavePolicy *policy, int local = 1) {
+    // by default a local capacity the trace spills out of part way through, into expanders that never fill
+    ControllerConfig config{
+        .capacity = {local, 1 << 20, 1 << 20, 1 << 20},
+        .latency = {100, 150, 100, 150, 100, 150},
+        .bandwidth = {50, 50, 50, 50, 50, 50},
+        .topology = "(1,(2,3))",
+    };
+    return std::unique_ptr<CXLController>(config.build(policy));
+}
+
+int main() {
+    constexpr size_t samples = 400000, per_epoch = 100000;
+    constexpr uint64_t pages = 3ULL * 1024 * 1024 * 1024 / 4096;
+    uint64_t state = 0x2545f4914f6cdd1d;
+    SampleBatch trace;
+    for (size_t i = 0; i < samples; i++) {
+        auto page = xorshift(state) % pages;
+        auto addr = 0x100000000 + page * 4096 + xorshift(state) % 4096;
+        uint8_t types[] = {ACCESS_LOAD, ACCESS_STORE, ACCESS_UNKNOWN};
+        trace.push_back(1000000 + i * 700, 0x7f0000000000 + page * 4096, addr, 1, types[xorshift(state) % 3]);
+    }
+
+    InterleavePolicy by_sample_policy, by_batch_policy;
+    auto by_sample = build(&by_sample_policy);
+    auto by_batch = build(&by_batch_policy);
+    SampleBatch batch;
+    for (size_t begin = 0; begin < samples; begin += per_epoch) {
+        batch.clear();
+        for (auto i = begin; i < begin + per_epoch; i++) {
+            by_sample->insert(trace.timestamp[i], trace.phys_addr[i], trace.virt_addr[i], 0, trace.type[i]);
+            batch.push_back(trace.timestamp[i], trace.virt_addr[i], trace.phys_addr[i], trace.tid[i], trace.type[i]);
+        }
+        by_batch->insert_batch(batch);
+        CHECK_EQ(epoch_delay(by_sample.get(), 110), epoch_delay(by_batch.get(), 110));
+        by_sample->age_out();
+        by_batch->age_out();
+    }
+
+    CHECK(by_sample->placement == by_batch->placement);
+    CHECK_EQ(by_sample->counter.local, by_batch->counter.local);
+    CHECK_EQ(by_sample->counter.remote, by_batch->counter.remote);
+    CHECK(by_batch->counter.local != 0 && by_batch->counter.remote != 0);
+    CHECK_EQ(by_sample->occupation.size(), by_batch->occupation.size());
+    for (size_t i = 0; i < by_sample->cur_expanders.size(); i++) {
+        auto a = by_sample->cur_expanders[i], b = by_batch->cur_expanders[i];
+        CHECK_EQ(a->occupation.size(), b->occupation.size());
+        CHECK_EQ(a->counter.load, b->counter.load);
+        CHECK_EQ(a->counter.store, b->counter.store);
+        auto ia = a->occupation.begin(), ib = b->occupation.begin();
+        for (; ia != a->occupation.end() && ib != b->occupation.end(); ++ia, ++ib) {
+            CHECK(ia->address == ib->address && ia->last_touch == ib->last_touch && ia->reads == ib->reads &&
+                  ia->writes == ib->writes);
+        }
+    }
+
+    // stores are charged at their own weight, the loads at the batch weight
+    InterleavePolicy weighted_policy;
+    auto weighted = build(&weighted_policy, 0);
+    batch.clear();
+    for (size_t i = 0; i < per_epoch; i++) {
+        if (trace.type[i] != ACCESS_UNKNOWN) {
+            batch.push_back(trace.timestamp[i], trace.virt_addr[i], trace.phys_addr[i], trace.tid[i], trace.type[i]);
+        }
+    }
+    batch.weight = 2;
+    batch.store_weight = 30;
+    weighted->insert_batch(batch);
+    double loads = 0, stores = 0;
+    uint64_t load_samples = 0, store_samples = 0;
+    for (size_t i = 0; i < weighted->cur_expanders.size(); i++) {
+        loads += weighted->topology.load[i];
+        stores += weighted->topology.store[i];
+        load_samples += weighted->cur_expanders[i]->counter.load;
+        store_samples += weighted->cur_expanders[i]->counter.store;
+    }
+    CHECK(load_samples != 0 && store_samples != 0);
+    CHECK_EQ(loads, 2. * (double)load_samples);
+    CHECK_EQ(stores, 30. * (double)store_samples);
+    return check_failures != 0;
+}
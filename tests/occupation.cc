@@ -0,0 +1,105 @@
+/** Dropping an address range: only units wholly inside it go, here, in the expanders and from the placement, and
+ * nothing is counted as an access */
+#include "check.h"
+#include "cxlcontroller.h"
+#include "helper.h"
+#include "policy.h"
+#include <memory>
+
+Helper helper{};
+
+static std::unique_ptr<CXLController> build(InterleavePolicy *policy, std::vector<int> capacity) {
+    ControllerConfig config{
+        .capacity = std::move(capacity),
+        .latency = {100, 150, 100, 150, 100, 150},
+        .bandwidth = {50, 50, 50, 50, 50, 50},
+        .topology = "(1,(2,3))",
+    };
+    return std::unique_ptr<CXLController>(config.build(policy));
+}
+
+static size_t expander_units(CXLController *controller) {
+    size_t n = 0;
+    for (auto expander : controller->cur_expanders) {
+        n += expander->occupation.size();
+    }
+    return n;
+}
+
+static uint64_t expander_loads(CXLController *controller) {
+    uint64_t n = 0;
+    for (auto expander : controller->cur_expanders) {
+        n += expander->counter.load;
+    }
+    return n;
+}
+
+int main() {
+    Occupation occupation;
+    occupation.set_granularity(4096);
+    for (uint64_t page = 1; page <= 4; page++) {
+        occupation.insert(page, page * 4096);
+    }
+    // [0x1800, 0x3800) only covers the page at 0x2000 wholly
+    CHECK_EQ(occupation.erase_range(0x1800, 0x3800), 1);
+    CHECK(occupation.contains(0x1000));
+    CHECK(!occupation.contains(0x2000));
+    CHECK(occupation.contains(0x3000));
+    CHECK_EQ(occupation.erase_range(0x1000, 0x1fff), 0);
+    CHECK_EQ(occupation.erase_range(0x1000, 0x2000), 1);
+    CHECK_EQ(occupation.erase_range(0x3000, UINT64_MAX), 2);
+    CHECK(occupation.empty());
+
+    constexpr uint64_t virt = 0x7f0000000000, phys = 0x100000000;
+    // a local memory the pages stay in, then none so they go to the expanders
+    for (auto local : {1, 0}) {
+        InterleavePolicy policy;
+        auto controller = build(&policy, {local, 20, 20, 20});
+        for (uint64_t page = 0; page < 8; page++) {
+            controller->insert(1000 + page, phys + page * 4096, virt + page * 4096, 0, ACCESS_LOAD);
+        }
+        auto units = [&] { return controller->occupation.size() + expander_units(controller.get()); };
+        CHECK_EQ(units(), 8);
+        CHECK_EQ(controller->placement.size(), 8);
+        auto loads = expander_loads(controller.get());
+
+        // half of page 0 and half of page 1, neither goes
+        controller->delete_entry(virt + 2048, 4096);
+        CHECK_EQ(units(), 8);
+        CHECK_EQ(controller->placement.size(), 8);
+
+        // pages 2 and 3 whole and half of page 4
+        controller->delete_entry(virt + 2 * 4096, 2 * 4096 + 2048);
+        CHECK_EQ(units(), 6);
+        CHECK_EQ(controller->placement.size(), 6);
+        CHECK(!controller->placement.contains(phys + 2 * 4096));
+        CHECK(controller->placement.contains(phys + 4 * 4096));
+
+        controller->delete_entry(virt, 8 * 4096);
+        CHECK_EQ(units(), 0);
+        CHECK(controller->placement.empty());
+        // freeing is no access
+        CHECK_EQ(expander_loads(controller.get()), loads);
+    }
+
+    // a budget of 4 entries per place ages the older pages out, their placement goes at the epoch end
+    for (auto local : {1, 0}) {
+        InterleavePolicy policy;
+        auto controller = build(&policy, {local, 20, 20, 20});
+        controller->set_window(0, 4);
+        for (uint64_t page = 0; page < 16; page++) {
+            controller->insert(1000 + page, phys + page * 4096, virt + page * 4096, 0, ACCESS_LOAD);
+        }
+        controller->age_out();
+        auto units = controller->occupation.size() + expander_units(controller.get());
+        CHECK(units < 16);
+        CHECK_EQ(controller->placement.size(), units);
+        for (auto const &[unit, index] : controller->placement) {
+            CHECK(index == -1 ? controller->occupation.contains(unit)
+                              : controller->cur_expanders[index]->occupation.contains(unit));
+        }
+        CHECK(controller->placement.contains(phys + 15 * 4096));
+    }
+
+    return check_failures != 0;
+}
@@ -0,0 +1,43 @@
+/** InterleavePolicy against the capacities in GB: local memory until 90% full, then the expanders in turn until each
+ * is full, then local again rather than searching forever */
+#include "check.h"
+#include "cxlcontroller.h"
+#include "helper.h"
+#include "policy.h"
+#include <memory>
+
+Helper helper{};
+
+int main() {
+    // 1 GB everywhere in 2 MB units: 460 units fill local memory to 90%, 512 fill an expander
+    InterleavePolicy policy;
+    ControllerConfig config{
+        .capacity = {1, 1, 1, 1},
+        .latency = {100, 150, 100, 150, 100, 150},
+        .bandwidth = {50, 50, 50, 50, 50, 50},
+        .topology = "(1,(2,3))",
+        .mode = HUGEPAGE_2M,
+    };
+    std::unique_ptr<CXLController> controller(config.build(&policy));
+    constexpr uint64_t unit = 2 * 1024 * 1024, units = 2100;
+    std::vector<int> placed;
+    for (uint64_t i = 0; i < units; i++) {
+        controller->insert(1000 + i, 0x100000000 + i * unit, 0x7f0000000000 + i * unit, 0, ACCESS_LOAD);
+        placed.push_back(controller->placement.at(0x100000000 + i * unit));
+    }
+
+    size_t local = 0;
+    for (uint64_t i = 0; i < 461; i++) {
+        local += placed[i] == -1;
+    }
+    CHECK_EQ(local, 461);
+    CHECK(placed[461] != -1);
+    for (auto expander : controller->cur_expanders) {
+        CHECK_EQ(expander->occupation.size(), 512);
+    }
+    // every expander full, the rest stays local
+    CHECK_EQ(controller->occupation.size(), units - 3 * 512);
+    CHECK_EQ(placed.back(), -1);
+
+    return check_failures != 0;
+}
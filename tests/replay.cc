@@ -0,0 +1,106 @@
+/** Record a small trace the way the epoch loop in main.cc does and replay it: the same delay epoch by epoch, with
+ * per task and with cpu wide sampling, raw and packed */
+#include "check.h"
+#include "helper.h"
+#include "policy.h"
+#include "replay.h"
+#include <filesystem>
+#include <memory>
+#include <unistd.h>
+
+Helper helper{};
+
+static constexpr double dramlatency = 110;
+
+static uint64_t xorshift(uint64_t &state) {
+    state ^= state << 13;
+    state ^= state >> 7;
+    state ^= state << 17;
+    return state;
+}
+
+static ControllerConfig config() {
+    // nothing local and expanders that never fill
+    return {
+        .capacity = {0, 1 << 20, 1 << 20, 1 << 20},
+        .latency = {100, 150, 100, 150, 100, 150},
+        .bandwidth = {50, 50, 50, 50, 50, 50},
+        .topology = "(1,(2,3))",
+        .interval = 10,
+        .window = 2,
+    };
+}
+
+static void fill(SampleBatch &batch, uint64_t &timestamp, uint64_t &state, size_t n) {
+    batch.clear();
+    for (size_t i = 0; i < n; i++) {
+        timestamp += 1000 + xorshift(state) % 3000;
+        auto addr = 0x100000000 + xorshift(state) % (64 * 1024 * 1024);
+        batch.push_back(timestamp, 0x7f0000000000 + addr, addr, 1, xorshift(state) % 4 ? ACCESS_LOAD : ACCESS_STORE);
+    }
+}
+
+static constexpr uint32_t monitors = 3;
+
+/** the live loop of the monitors over a few epochs, return the delay charged per epoch */
+static std::vector<uint64_t> record(const std::string &path, bool packed, bool cpu_wide) {
+    InterleavePolicy policy;
+    auto cfg = config();
+    std::unique_ptr<CXLController> controller(cfg.build(&policy));
+    TraceWriter trace(path, 0, cfg.interval, 1, false, packed);
+    std::vector<uint64_t> delays;
+    uint64_t timestamp = 1000000, state = 0x853c49e6748fea9b;
+    SampleBatch batch;
+    for (uint64_t epoch = 0; epoch < 6; epoch++) {
+        uint64_t delay = 0;
+        if (cpu_wide) {
+            fill(batch, timestamp, state, 30000);
+            batch.weight = 1.5;
+            controller->insert_batch(batch);
+            trace.samples(epoch, TRACE_CPU_WIDE, batch);
+        }
+        for (uint32_t i = 0; i < monitors; i++) {
+            if (cpu_wide) {
+                trace.samples(epoch, i, SampleBatch{});
+            } else {
+                // the second monitor sits an epoch out now and then, its record is there all the same
+                fill(batch, timestamp, state, i == 1 && epoch % 2 ? 0 : 80000 + i * 1000);
+                batch.weight = 1 + i;
+                controller->insert_batch(batch);
+                trace.samples(epoch, i, batch);
+            }
+            delay += epoch_delay(controller.get(), dramlatency);
+        }
+        controller->age_out();
+        trace.epoch(epoch, {}, {});
+        delays.push_back(delay);
+    }
+    trace.close();
+    return delays;
+}
+
+int main() {
+    auto path = (std::filesystem::temp_directory_path() / fmt::format("cxlmemsim_replay_{}.trace", getpid())).string();
+    for (auto packed : {false, true}) {
+        for (auto cpu_wide : {false, true}) {
+            auto live = record(path, packed, cpu_wide);
+            TraceReader trace(path);
+            CHECK(trace.ok());
+            if (!trace.ok()) {
+                continue;
+            }
+            InterleavePolicy policy;
+            std::unique_ptr<CXLController> controller(config().build(&policy));
+            auto replayed = replay(trace, controller.get(), dramlatency);
+            CHECK(replayed.ok);
+            CHECK_EQ(replayed.epochs.size(), live.size());
+            for (size_t e = 0; e < std::min(live.size(), replayed.epochs.size()); e++) {
+                CHECK(live[e] != 0);
+                CHECK_EQ(replayed.epochs[e].delay, live[e]);
+                CHECK_EQ(replayed.epochs[e].charges, (uint64_t)monitors);
+            }
+        }
+    }
+    std::filesystem::remove(path);
+    return check_failures != 0;
+}
@@ -0,0 +1,164 @@
+/** Trace round trips, and records whose stated counts do not fit their size are rejected instead of read past */
+#include "check.h"
+#include "helper.h"
+#include "trace.h"
+#include <filesystem>
+#include <cstddef>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <unistd.h>
+
+Helper helper{};
+
+static std::string temp(const char *name) {
+    return (std::filesystem::temp_directory_path() / fmt::format("cxlmemsim_{}_{}.trace", name, getpid())).string();
+}
+
+static SampleBatch batch_of(size_t n) {
+    SampleBatch batch;
+    for (size_t i = 0; i < n; i++) {
+        batch.push_back(1000 + i * 300, 0x7f0000000000 + i * 4096, 0x100000000 + i * 64, 7, i % 3);
+    }
+    batch.weight = 2;
+    batch.store_weight = 50;
+    return batch;
+}
+
+static std::vector<char> load(const std::string &path) {
+    std::ifstream in(path, std::ios::binary);
+    return {std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>()};
+}
+
+static void store(const std::string &path, const std::vector<char> &bytes) {
+    std::ofstream(path, std::ios::binary).write(bytes.data(), (std::streamsize)bytes.size());
+}
+
+/** the first sample record of the file, with its offset */
+static std::pair<const TraceRecord *, size_t> first_samples(const TraceReader &reader) {
+    auto offset = reader.begin();
+    for (auto at = offset; auto *record = reader.next(offset); at = offset) {
+        if (record->kind == TRACE_SAMPLES || record->kind == TRACE_BLOCK) {
+            return {record, at};
+        }
+    }
+    return {nullptr, 0};
+}
+
+/** write one epoch of n samples and read it back */
+static std::vector<char> round_trip(const std::string &path, bool packed, size_t n) {
+    auto written = batch_of(n);
+    {
+        TraceWriter writer(path, 0, 1000, 1, false, packed);
+        writer.samples(0, 0, written);
+        writer.epoch(0, {}, {});
+    }
+    TraceReader reader(path);
+    CHECK(reader.ok());
+    auto [record, at] = first_samples(reader);
+    CHECK(record != nullptr);
+    if (record != nullptr) {
+        SampleBatch batch;
+        CHECK_EQ(reader.samples(record, batch), 1);
+        CHECK(batch.timestamp == written.timestamp && batch.virt_addr == written.virt_addr &&
+              batch.phys_addr == written.phys_addr && batch.tid == written.tid && batch.type == written.type);
+        CHECK_EQ(batch.weight, written.weight);
+        CHECK_EQ(batch.store_weight, written.store_weight);
+    }
+    return load(path);
+}
+
+/** a raw trace taken back to version 3, whose sample head ends at the one weight, still reads with that weight for
+ * the stores too */
+static void read_version3(const std::string &path, std::vector<char> bytes) {
+    size_t at;
+    {
+        TraceReader original(path);
+        at = first_samples(original).second;
+    }
+    auto *header = (TraceHeader *)bytes.data();
+    header->version = 3;
+    header->index -= sizeof(double);
+    ((TraceRecord *)(bytes.data() + at))->size -= sizeof(double);
+    auto store_weight = bytes.begin() + (ptrdiff_t)(at + sizeof(TraceRecord) + offsetof(TraceSamples, store_weight));
+    bytes.erase(store_weight, store_weight + sizeof(double));
+    store(path, bytes);
+
+    TraceReader reader(path);
+    auto [record, unused] = first_samples(reader);
+    CHECK(record != nullptr);
+    if (record != nullptr) {
+        SampleBatch batch;
+        auto written = batch_of(1000);
+        CHECK_EQ(reader.samples(record, batch), 1);
+        CHECK(batch.timestamp == written.timestamp && batch.type == written.type);
+        CHECK_EQ(batch.weight, written.weight);
+        CHECK_EQ(batch.store_weight, written.weight);
+    }
+    CHECK_EQ(reader.index().size(), 1);
+}
+
+/** the samples of the record at offset, after corrupt changed the file */
+template <typename F> static int read_corrupted(const std::string &path, std::vector<char> bytes, F &&corrupt) {
+    TraceReader original(path);
+    auto at = first_samples(original).second;
+    corrupt(bytes.data() + at);
+    store(path, bytes);
+    TraceReader reader(path);
+    auto offset = at;
+    auto *record = reader.next(offset);
+    if (record == nullptr) {
+        return -2; // refused by the walk
+    }
+    SampleBatch batch;
+    auto r = reader.samples(record, batch);
+    CHECK(r >= 0 || batch.empty());
+    return r;
+}
+
+int main() {
+    auto path = temp("trace");
+
+    /* raw: a count larger than the record holds */
+    auto raw = round_trip(path, false, 1000);
+    CHECK_EQ(read_corrupted(path, raw,
+                            [](char *record) {
+                                auto *head = (TraceSamples *)(record + sizeof(TraceRecord));
+                                head->count = 1001;
+                            }),
+             -1);
+    CHECK_EQ(read_corrupted(path, raw,
+                            [](char *record) {
+                                auto *head = (TraceSamples *)(record + sizeof(TraceRecord));
+                                head->count = UINT32_MAX;
+                            }),
+             -1);
+    /* a record too short for its own head */
+    CHECK_EQ(read_corrupted(path, raw, [](char *record) { ((TraceRecord *)record)->size = 8; }), -2);
+    round_trip(path, false, 1000);
+    read_version3(path, raw);
+
+    /* packed: the count, the column sizes and the varints themselves all have to agree with the record */
+    auto packed = round_trip(path, true, 1000);
+    auto block = [](char *record) { return (TraceBlock *)(record + sizeof(TraceRecord)); };
+    CHECK_EQ(read_corrupted(path, packed, [&](char *record) { block(record)->count = UINT32_MAX; }), -1);
+    CHECK_EQ(read_corrupted(path, packed, [&](char *record) { block(record)->count = 1001; }), -1);
+    CHECK_EQ(read_corrupted(path, packed, [&](char *record) { block(record)->size[1] += 4096; }), -1);
+    CHECK_EQ(read_corrupted(path, packed,
+                            [&](char *record) {
+                                // shift a byte from one column to the next, the total still fits the record
+                                block(record)->size[0]++;
+                                block(record)->size[1]--;
+                            }),
+             -1);
+    CHECK_EQ(read_corrupted(path, packed,
+                            [&](char *record) {
+                                // continuation bits all through the timestamps run them into the next column
+                                auto *head = block(record);
+                                memset(head + 1, 0xff, head->size[0]);
+                            }),
+             -1);
+
+    std::filesystem::remove(path);
+    return check_failures != 0;
+}